@@ -0,0 +1,389 @@
+/*
+ * Host simulation of the aggregator mode.
+ *
+ * Replays the same synthetic traces on N nodes twice over loopback sockets:
+ *
+ *  - standalone: every node opens its own TCP connection to the server on each
+ *    flush, as tcp_client() + send_data_buffer() do on the device.
+ *  - aggregated: node 0 is the aggregator, the other nodes send their batches
+ *    to it over UDP, and it forwards full frames over one persistent connection.
+ *
+ * The dead-band filter and the flush rules are the ones of driver.c, driven
+ * by a virtual clock of one sample per second. The aggregator merges the
+ * batches with frame_aggregator_add_batch(), the code of aggregator.c.
+ *
+ * Usage: aggregator_sim [nodes] [seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "driver.h"
+#include "frame.h"
+
+/* Header-only packets of a TCP connection: 3 for the handshake, 4 for the teardown */
+#define TCP_CONNECTION_PACKETS (7)
+/* IPv4 + TCP header without options */
+#define TCP_IP_HEADER_SIZE (40)
+
+#define MAX_NODES (64)
+
+/**
+ * @brief State of one simulated node: trace generator and driver queue.
+ */
+struct node {
+  int deviceId;
+  unsigned int seed;
+  float temperature;
+  float reference;
+  uint32_t sequence;
+  uint8_t batch[FRAME_BATCH_HEADER_SIZE(FRAME_FLAGS) + MAX_LENGHT * FRAME_BATCH_RECORD_SIZE(FRAME_FLAGS)];
+  struct frame_batch header;
+  int queued;
+  long last_flush;
+};
+
+/**
+ * @brief Totals measured for one mode.
+ */
+struct totals {
+  long connections;
+  long frames;
+  long payload_bytes;
+};
+
+static struct sockaddr_in sink_addr;
+static pthread_mutex_t sink_mutex = PTHREAD_MUTEX_INITIALIZER;
+static long sink_received;
+
+
+static void *sink_connection(void *arg){
+
+    int fd = (int)(intptr_t)arg;
+    uint8_t buf[4096];
+    ssize_t len;
+
+    while((len = recv(fd, buf, sizeof(buf), 0)) > 0){
+        pthread_mutex_lock(&sink_mutex);
+        sink_received += len;
+        pthread_mutex_unlock(&sink_mutex);
+    }
+    close(fd);
+    return NULL;
+}
+
+
+static void *sink_server(void *arg){
+
+    int listen_fd = (int)(intptr_t)arg;
+    pthread_t thread;
+    int fd;
+
+    while((fd = accept(listen_fd, NULL, NULL)) >= 0){
+        pthread_create(&thread, NULL, sink_connection, (void *)(intptr_t)fd);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+
+static int tcp_connect(void){
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if(fd < 0 || connect(fd, (struct sockaddr *)&sink_addr, sizeof(sink_addr)) != 0){
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+
+static void send_all(int fd, const uint8_t *data, size_t len){
+
+    while(len > 0){
+        ssize_t sent = send(fd, data, len, 0);
+        if(sent <= 0){
+            perror("send");
+            exit(1);
+        }
+        data += sent;
+        len -= (size_t)sent;
+    }
+}
+
+
+static void node_init(struct node *n, int deviceId){
+    memset(n, 0, sizeof(*n));
+    n->deviceId = deviceId;
+    n->seed = 1000u + (unsigned int)deviceId;
+    n->reference = INFINITY;
+    n->header.flags = FRAME_FLAGS;
+}
+
+/*
+ * Writes the batch header of the queued samples.
+ *
+ * @return The size of the batch in bytes.
+ */
+static size_t node_batch(struct node *n, long now){
+
+    n->header.mode = COMPRESSION_DEADBAND;
+    n->header.count = (uint16_t)n->queued;
+    n->header.send_time = (int64_t)now * 1000000;
+    frame_batch_header(n->batch, &n->header);
+    return FRAME_BATCH_HEADER_SIZE(n->header.flags) + n->queued * FRAME_BATCH_RECORD_SIZE(n->header.flags);
+}
+
+/*
+ * Samples the trace of the node and applies the filter of process_sensor_data().
+ *
+ * @return true if the queue must be flushed.
+ */
+static bool node_sample(struct node *n, long now){
+
+    struct sensor sample;
+    int threshold_result;
+
+    //daily-like oscillation with noise and occasional steps
+    n->temperature = 25.0f + (float)(n->deviceId % 5)
+                   + 6.0f * sinf((float)now / 600.0f + (float)n->deviceId)
+                   + ((float)(rand_r(&n->seed) % 201) - 100.0f) / 100.0f;
+    if(rand_r(&n->seed) % 300 == 0){
+        n->temperature += 8.0f;
+    }
+
+    sample.deviceId = n->deviceId;
+    sample.measurementType = 1;
+    sample.value = n->temperature;
+    sample.sequence = n->sequence++;
+    sample.timestamp = (int64_t)now * 1000000;
+
+    threshold_result = OUTSIDE_TOLERANCE(sample.value, n->reference);
+    if(threshold_result){
+        n->reference = sample.value;
+        if(n->queued == 0){
+            n->header.base_time = sample.timestamp;
+        }
+        frame_batch_record(&n->batch[FRAME_BATCH_HEADER_SIZE(n->header.flags) + n->queued * FRAME_BATCH_RECORD_SIZE(n->header.flags)],
+                           &n->header, &sample);
+        n->queued++;
+    }
+
+    return n->queued == MAX_LENGHT
+        || threshold_result == CRITICAL_THRESHOLD_RESULT
+        || (now - n->last_flush) * 1000 >= MAX_TIME;
+}
+
+
+static void wait_sink(long expected){
+
+    for(;;){
+        pthread_mutex_lock(&sink_mutex);
+        long received = sink_received;
+        pthread_mutex_unlock(&sink_mutex);
+        if(received >= expected){
+            return;
+        }
+        usleep(1000);
+    }
+}
+
+
+static struct totals run_standalone(int nodes, long seconds){
+
+    struct node node[MAX_NODES];
+    struct totals t = {0};
+
+    for(int i = 0; i < nodes; i++){
+        node_init(&node[i], i);
+    }
+
+    for(long now = 1; now <= seconds; now++){
+        for(int i = 0; i < nodes; i++){
+            if(node_sample(&node[i], now)){
+                //one connection and one frame per flush, like tcp_client()
+                size_t batch_len = node_batch(&node[i], now);
+                int fd = tcp_connect();
+                send_all(fd, node[i].batch, batch_len);
+                close(fd);
+                t.connections++;
+                t.frames++;
+                t.payload_bytes += batch_len;
+                node[i].queued = 0;
+                node[i].last_flush = now;
+            }
+        }
+    }
+    return t;
+}
+
+
+/**
+ * @brief Upstream connection of the aggregator, the ctx of aggregator_forward().
+ */
+struct upstream {
+  int fd;
+  long now;
+  struct totals *t;
+};
+
+
+/*
+ * Sends the frame of the aggregator over one persistent connection, as send_data_persistent() does.
+ */
+static void aggregator_forward(struct frame_aggregator *agg, void *ctx){
+
+    static uint8_t frame_buffer[TRANSMISSION_BUFFER_SIZE];
+    struct upstream *upstream = ctx;
+    size_t len = frame_aggregator_encode(agg, frame_buffer, sizeof(frame_buffer), (int64_t)upstream->now * 1000000);
+
+    if(len == 0){
+        return;
+    }
+    if(upstream->fd < 0){
+        upstream->fd = tcp_connect();
+        upstream->t->connections++;
+    }
+    send_all(upstream->fd, frame_buffer, len);
+    upstream->t->frames++;
+    upstream->t->payload_bytes += len;
+}
+
+
+static struct totals run_aggregated(int nodes, long seconds){
+
+    static struct frame_aggregator agg;
+    struct node node[MAX_NODES];
+    struct totals t = {0};
+    struct sockaddr_in udp_addr;
+    socklen_t addr_len = sizeof(udp_addr);
+    uint8_t rx_buffer[TRANSMISSION_BUFFER_SIZE];
+    struct upstream upstream = { -1, 0, &t };
+    int udp_rx, udp_tx;
+    ssize_t len;
+
+    //loopback transport between the peers and the aggregator
+    udp_rx = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&udp_addr, 0, sizeof(udp_addr));
+    udp_addr.sin_family = AF_INET;
+    udp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    udp_addr.sin_port = 0;
+    if(bind(udp_rx, (struct sockaddr *)&udp_addr, sizeof(udp_addr)) != 0){
+        perror("bind");
+        exit(1);
+    }
+    getsockname(udp_rx, (struct sockaddr *)&udp_addr, &addr_len);
+    fcntl(udp_rx, F_SETFL, O_NONBLOCK);
+    udp_tx = socket(AF_INET, SOCK_DGRAM, 0);
+
+    frame_aggregator_init(&agg, FRAME_FLAGS);
+    for(int i = 0; i < nodes; i++){
+        node_init(&node[i], i);
+    }
+
+    //the nodes share the virtual clock, so the merge of aggregator.c applies no offset to the timestamps
+    for(long now = 1; now <= seconds; now++){
+        upstream.now = now;
+        for(int i = 0; i < nodes; i++){
+            if(node_sample(&node[i], now)){
+                size_t batch_len = node_batch(&node[i], now);
+                if(i == 0){
+                    //the aggregator merges its own data directly
+                    frame_aggregator_add_batch(&agg, node[i].batch, batch_len, (int64_t)now * 1000000,
+                                               aggregator_forward, &upstream);
+                }else{
+                    sendto(udp_tx, node[i].batch, batch_len, 0, (struct sockaddr *)&udp_addr, sizeof(udp_addr));
+                }
+                node[i].queued = 0;
+                node[i].last_flush = now;
+            }
+        }
+
+        while((len = recv(udp_rx, rx_buffer, sizeof(rx_buffer), 0)) > 0){
+            frame_aggregator_add_batch(&agg, rx_buffer, (size_t)len, (int64_t)now * 1000000,
+                                       aggregator_forward, &upstream);
+        }
+
+        if(agg.n_samples > 0 && (int64_t)now * 1000000 - agg.first_time >= (int64_t)AGGREGATOR_MAX_TIME * 1000){
+            aggregator_forward(&agg, &upstream);
+        }
+    }
+    aggregator_forward(&agg, &upstream);
+
+    if(upstream.fd >= 0){
+        close(upstream.fd);
+    }
+    close(udp_rx);
+    close(udp_tx);
+    return t;
+}
+
+
+static void print_totals(const char *mode, const struct totals *t){
+
+    long wire = t->payload_bytes
+              + t->frames * TCP_IP_HEADER_SIZE
+              + t->connections * TCP_CONNECTION_PACKETS * TCP_IP_HEADER_SIZE;
+
+    printf("%-11s %11ld %8ld %13ld %11ld %12.1f\n", mode, t->connections, t->frames,
+           t->payload_bytes, wire, t->frames ? (double)t->payload_bytes / t->frames : 0.0);
+}
+
+
+int main(int argc, char **argv){
+
+    int nodes = argc > 1 ? atoi(argv[1]) : 8;
+    long seconds = argc > 2 ? atol(argv[2]) : 3600;
+    socklen_t addr_len = sizeof(sink_addr);
+    pthread_t sink_thread;
+    struct totals standalone, aggregated;
+    int listen_fd;
+
+    if(nodes < 1 || nodes > MAX_NODES || seconds < 1){
+        fprintf(stderr, "usage: %s [nodes 1..%d] [seconds]\n", argv[0], MAX_NODES);
+        return 1;
+    }
+
+    //server side: counts the bytes of every connection
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&sink_addr, 0, sizeof(sink_addr));
+    sink_addr.sin_family = AF_INET;
+    sink_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(listen_fd, (struct sockaddr *)&sink_addr, sizeof(sink_addr)) != 0 || listen(listen_fd, 64) != 0){
+        perror("listen");
+        return 1;
+    }
+    getsockname(listen_fd, (struct sockaddr *)&sink_addr, &addr_len);
+    pthread_create(&sink_thread, NULL, sink_server, (void *)(intptr_t)listen_fd);
+
+    standalone = run_standalone(nodes, seconds);
+    wait_sink(standalone.payload_bytes);
+    aggregated = run_aggregated(nodes, seconds);
+    wait_sink(standalone.payload_bytes + aggregated.payload_bytes);
+
+    printf("%d nodes, %ld s, 1 sample/s per node, TRANSMISSION_BUFFER_SIZE %d\n\n",
+           nodes, seconds, TRANSMISSION_BUFFER_SIZE);
+    printf("%-11s %11s %8s %13s %11s %12s\n", "mode", "connections", "frames",
+           "payload_bytes", "wire_bytes", "bytes/frame");
+    print_totals("standalone", &standalone);
+    print_totals("aggregated", &aggregated);
+    printf("\nupstream change: frames %+.1f%%, payload bytes %+.1f%%, wire bytes %+.1f%%\n",
+           100.0 * ((double)aggregated.frames / standalone.frames - 1.0),
+           100.0 * ((double)aggregated.payload_bytes / standalone.payload_bytes - 1.0),
+           100.0 * ((double)(aggregated.payload_bytes + aggregated.frames * TCP_IP_HEADER_SIZE
+                             + aggregated.connections * TCP_CONNECTION_PACKETS * TCP_IP_HEADER_SIZE)
+                    / (standalone.payload_bytes + standalone.frames * TCP_IP_HEADER_SIZE
+                       + standalone.connections * TCP_CONNECTION_PACKETS * TCP_IP_HEADER_SIZE) - 1.0));
+
+    return 0;
+}
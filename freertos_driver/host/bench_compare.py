@@ -0,0 +1,91 @@
+"""Compares the results of a micro-benchmark with its stored baseline.
+
+The files are the JSON printed by micro_bench (driver) or by
+http_server/micro_bench.py (server). A kernel regresses when its ns/sample is
+more than threshold above the baseline; the script then exits with 1. Kernels
+missing from the results also fail, new kernels are only reported.
+
+When both files have "relative" results, the median ratio of each kernel to a
+fixed calibration loop timed right before it in the same process, those are
+compared instead, so a baseline recorded on another machine, or while the host
+was busier or idler, still applies.
+
+With --merge, the results of several runs are merged into one file with the
+fastest ns/sample and the median relative result of each kernel.
+
+Usage: python3 bench_compare.py baseline.json results.json [--threshold 0.5]
+       python3 bench_compare.py --merge merged.json run1.json run2.json ...
+"""
+import argparse
+import json
+import statistics
+import sys
+
+def load(path):
+    with open(path) as f:
+        return json.load(f)
+
+
+def merge(output, paths):
+    runs = [load(path) for path in paths]
+    merged = dict(runs[0])
+    merged['merged'] = len(runs)
+    merged['results'] = {name: round(min(run['results'][name] for run in runs if name in run['results']), 3)
+                         for name in runs[0]['results']}
+    if all('relative' in run for run in runs):
+        merged['relative'] = {name: round(statistics.median(run['relative'][name] for run in runs
+                                                            if name in run['relative']), 4)
+                              for name in runs[0]['relative']}
+    with open(output, 'w') as f:
+        json.dump(merged, f, indent=2)
+        f.write('\n')
+
+
+def compare(baseline, results, threshold):
+    """Print the change of each kernel, return True if none regressed."""
+    if baseline.get('unit') != results.get('unit'):
+        sys.exit('unit mismatch: {} vs {}'.format(baseline.get('unit'), results.get('unit')))
+
+    relative = 'relative' in baseline and 'relative' in results
+    reference_results = baseline['relative'] if relative else baseline['results']
+    current_results = results['relative'] if relative else results['results']
+    unit = 'x calibration' if relative else results.get('unit')
+
+    ok = True
+    print('{} ({}), threshold {:+.0%}'.format(results.get('suite'), unit, threshold))
+    print('{:<20} {:>10} {:>10} {:>8}'.format('kernel', 'baseline', 'current', 'change'))
+    for name, reference in reference_results.items():
+        current = current_results.get(name)
+        if current is None:
+            print('{:<20} {:>10.3f} {:>10} {:>8}  MISSING'.format(name, reference, '-', '-'))
+            ok = False
+            continue
+        change = current / reference - 1 if reference > 0 else 0.0
+        regressed = change > threshold
+        ok &= not regressed
+        print('{:<20} {:>10.3f} {:>10.3f} {:>+8.1%}{}'.format(name, reference, current, change,
+                                                            '  REGRESSION' if regressed else ''))
+    for name, current in current_results.items():
+        if name not in reference_results:
+            print('{:<20} {:>10} {:>10.3f} {:>8}  NEW'.format(name, '-', current, '-'))
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('files', nargs='+', help='baseline.json results.json, or the runs to merge')
+    parser.add_argument('--threshold', type=float, default=0.5,
+                        help='max relative increase of each kernel, 0.5 = 50%%')
+    parser.add_argument('--merge', metavar='OUTPUT', help='merge the runs into OUTPUT instead of comparing')
+    args = parser.parse_args()
+
+    if args.merge:
+        merge(args.merge, args.files)
+        return
+    if len(args.files) != 2:
+        parser.error('expected baseline.json results.json')
+    sys.exit(0 if compare(load(args.files[0]), load(args.files[1]), args.threshold) else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,177 @@
+/*
+ * Host benchmark of the compression modes of the driver.
+ *
+ * Replays identical traces through the dead-band filter of process_sensor_data()
+ * and through the swinging-door compression, and rebuilds them as the server
+ * does: holding the last value for the dead-band, interpolating between the
+ * segment endpoints for the swinging door.
+ *
+ * For a fair comparison the swinging-door deviation is set to the max error
+ * measured for the dead-band on the same trace, so both modes are compared at
+ * the same error bound.
+ *
+ * Usage: compression_bench [samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "driver.h"
+#include "compression.h"
+
+#define TRACE_NOISE (0.1f)
+
+/**
+ * @brief Result of one compression mode on one trace.
+ */
+struct result {
+  long points;       /**< Number of samples transmitted. */
+  float max_error;   /**< Max absolute error of the reconstruction. */
+};
+
+
+static float noise(unsigned int *seed){
+    return TRACE_NOISE * (((float)(rand_r(seed) % 2001) - 1000.0f) / 1000.0f);
+}
+
+/*
+ * Industrial batch process: heating ramp, hold at the setpoint, cooling ramp, idle.
+ */
+static float trace_ramp(long i, unsigned int *seed){
+
+    long t = i % 2000;
+    float value;
+
+    if(t < 400){
+        value = 20.0f + 60.0f * (float)t / 400.0f;
+    }else if(t < 1000){
+        value = 80.0f;
+    }else if(t < 1800){
+        value = 80.0f - 60.0f * (float)(t - 1000) / 800.0f;
+    }else{
+        value = 20.0f;
+    }
+    return value + noise(seed);
+}
+
+static float trace_sine(long i, unsigned int *seed){
+    return 50.0f + 20.0f * sinf(2.0f * (float)M_PI * (float)i / 2000.0f) + noise(seed);
+}
+
+static float trace_random_walk(long i, unsigned int *seed){
+    static float value;
+    if(i == 0){
+        value = 50.0f;
+    }
+    value += 5.0f * noise(seed);
+    return value;
+}
+
+
+static struct result run_deadband(const float *trace, long n, uint8_t pct){
+
+    struct result r = {0, 0.0f};
+    float reference = INFINITY;
+
+    for(long i = 0; i < n; i++){
+        if(OUTSIDE_TOLERANCE_PCT(trace[i], reference, pct, pct)){
+            reference = trace[i];
+            r.points++;
+        }
+        //the server holds the last value received
+        if(fabsf(trace[i] - reference) > r.max_error){
+            r.max_error = fabsf(trace[i] - reference);
+        }
+    }
+    return r;
+}
+
+
+static void check_segment(const float *trace, const struct sensor *from, const struct sensor *to, float *max_error){
+
+    for(uint32_t x = from->sequence; x <= to->sequence; x++){
+        float value = from->value;
+        if(to->sequence != from->sequence){
+            value += (to->value - from->value) * (float)(x - from->sequence) / (float)(to->sequence - from->sequence);
+        }
+        if(fabsf(trace[x] - value) > *max_error){
+            *max_error = fabsf(trace[x] - value);
+        }
+    }
+}
+
+
+static struct result run_swinging_door(const float *trace, long n, float deviation){
+
+    struct result r = {0, 0.0f};
+    struct sdt_state sdt;
+    struct sensor sample = {0, 1, 0.0f, 0, 0, COMPRESSION_SWINGING_DOOR};
+    struct sensor emitted;
+    struct sensor previous;
+
+    sdt_reset(&sdt);
+    for(long i = 0; i < n; i++){
+        sample.value = trace[i];
+        sample.sequence = (uint32_t)i;
+        if(sdt_process(&sdt, deviation, &sample, &emitted)){
+            //the server interpolates between two endpoints
+            if(r.points > 0){
+                check_segment(trace, &previous, &emitted, &r.max_error);
+            }
+            previous = emitted;
+            r.points++;
+        }
+    }
+    if(sdt_close(&sdt, &emitted)){
+        check_segment(trace, &previous, &emitted, &r.max_error);
+        r.points++;
+    }
+    return r;
+}
+
+
+int main(int argc, char **argv){
+
+    static const struct {
+        const char *name;
+        float (*generate)(long, unsigned int *);
+    } traces[] = {
+        { "ramp", trace_ramp },
+        { "sine", trace_sine },
+        { "random_walk", trace_random_walk },
+    };
+    static const uint8_t percentages[] = { 1, 2, 5 };
+    long n = argc > 1 ? atol(argv[1]) : 20000;
+    float *trace;
+
+    if(n < 2){
+        fprintf(stderr, "usage: %s [samples >= 2]\n", argv[0]);
+        return 1;
+    }
+    trace = malloc(n * sizeof(float));
+
+    printf("%ld samples per trace, deviation of the swinging door = max error of the dead-band\n\n", n);
+    printf("%-12s %4s %10s %10s %10s %10s %8s\n", "trace", "pct", "db_points", "db_maxerr",
+           "sdt_points", "sdt_maxerr", "db/sdt");
+
+    for(size_t t = 0; t < sizeof(traces) / sizeof(traces[0]); t++){
+        unsigned int seed = 42;
+        for(long i = 0; i < n; i++){
+            trace[i] = traces[t].generate(i, &seed);
+        }
+
+        for(size_t p = 0; p < sizeof(percentages); p++){
+            struct result deadband = run_deadband(trace, n, percentages[p]);
+            struct result sdt = run_swinging_door(trace, n, deadband.max_error);
+
+            printf("%-12s %3u%% %10ld %10.3f %10ld %10.3f %8.1f\n", traces[t].name, percentages[p],
+                   deadband.points, deadband.max_error, sdt.points, sdt.max_error,
+                   (double)deadband.points / sdt.points);
+        }
+    }
+
+    free(trace);
+    return 0;
+}
@@ -0,0 +1,330 @@
+/*
+ * Host simulation of independent instances of the driver.
+ *
+ * Runs driver.c unchanged on the host port of FreeRTOS (see port/), with many
+ * instances in parallel, each fed by its own sensor thread. Half of them are
+ * high-rate vibration sensors with swinging-door compression and large
+ * frames, the other half low-rate environmental sensors with dead-band and
+ * small frames. A vibration sensor interleaves the streams of its AXES axes
+ * in one instance.
+ *
+ * The transport of every instance decodes its frames and checks that they only
+ * carry samples of that instance, in the sequence order of each stream, within
+ * the frame size of its policy. The acks echo the send time, as the server does. One frame out of
+ * UNACKED_FRAMES gets no ack: every other time it is lost, as when the server
+ * could not make it durable, otherwise it is stored and only its ack is lost.
+ * Its samples must come back, in order, at the start of the next frame; the
+ * ones of a stored frame are then duplicates, dropped as the server does. Only
+ * the oldest of them may be missing, dropped when the queue filled up meanwhile.
+ *
+ * Halfway through the run the environmental streams switch to swinging door
+ * while samples are queued. Each frame must keep a single mode, so the mode of
+ * the frames of an instance changes once, and the last sample must be sent.
+ *
+ * Usage: driver_sim [instances] [seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "driver.h"
+#include "frame.h"
+
+#define MAX_INSTANCES (64)
+
+/* Period of the sensor threads in microseconds */
+#define VIBRATION_PERIOD (1000)
+#define ENVIRONMENT_PERIOD (20000)
+
+/* Streams of a vibration sensor, measurement types 2 .. 2 + AXES - 1 */
+#define AXES (3)
+
+/* One frame out of UNACKED_FRAMES is not acknowledged */
+#define UNACKED_FRAMES (5)
+
+/* Most samples in one frame */
+#define MAX_FRAME_SAMPLES (TRANSMISSION_BUFFER_SIZE / FRAME_BATCH_RECORD_SIZE(FRAME_FLAGS))
+
+/**
+ * @brief One instance of the driver with its sensor thread and the totals of its transport.
+ */
+struct instance {
+  char name[16];
+  int deviceId;
+  bool vibration;
+  driver_handle_t handle;
+  uint16_t frame_size;          /**< transmission_buffer_size of the policy. */
+  pthread_t sensor;
+  atomic_bool running;
+  long submitted;
+  long submitted_of[AXES];      /**< Samples submitted per stream. */
+  long sent;
+  long attempts;                /**< Frames given to the transport. */
+  long frames;
+  long unacked;
+  long duplicates;              /**< Samples of a stored frame sent again after its ack was lost. */
+  long requeue_dropped;         /**< Samples of an unacked frame that did not come back. */
+  long bytes;
+  long errors;
+  int64_t last_sequence[AXES]; /**< Last sequence sent per stream, -1 before the first one. */
+  int last_mode;                /**< Mode of the last frame, -1 before the first one. */
+  long mode_changes;
+  struct sensor pending[MAX_FRAME_SAMPLES];  /**< Samples of the last unacked frame. */
+  uint16_t n_pending;
+  bool pending_stored;          /**< The last unacked frame was stored, its samples come back as duplicates. */
+};
+
+
+/*
+ * Transport of the instances: checks the frame and answers with a plain ack.
+ */
+static int transport_check(void *ctx, uint8_t *frame, size_t frame_len, uint8_t *ack, size_t ack_len){
+
+    struct instance *instance = ctx;
+    struct frame_batch batch;
+    struct sensor samples[MAX_FRAME_SAMPLES];
+    uint32_t magic = FRAME_POLICY_MAGIC;
+    uint16_t resent = 0;
+    uint16_t first = 0;
+    bool resent_stored = false;
+    bool lost;
+    bool stored = true;
+
+    if(frame_len > instance->frame_size || !frame_batch_decode_header(frame, frame_len, &batch) ||
+       batch.count > MAX_FRAME_SAMPLES){
+        instance->errors++;
+        return 0;
+    }
+    for(uint16_t i = 0; i < batch.count; i++){
+        frame_batch_decode_record(&frame[FRAME_BATCH_HEADER_SIZE(batch.flags) + i * FRAME_BATCH_RECORD_SIZE(batch.flags)],
+                                  &batch, &samples[i]);
+    }
+
+    //the samples of the last unacked frame start this one, but for the oldest ones dropped by a full queue
+    if(instance->n_pending > 0){
+        while(first < instance->n_pending && (batch.count == 0 ||
+              instance->pending[first].sequence != samples[0].sequence ||
+              instance->pending[first].measurementType != samples[0].measurementType)){
+            first++;
+        }
+        if(first == instance->n_pending){
+            instance->errors++;
+        }
+        for(uint16_t i = first; i < instance->n_pending; i++, resent++){
+            if(resent >= batch.count || samples[resent].sequence != instance->pending[i].sequence ||
+               samples[resent].measurementType != instance->pending[i].measurementType ||
+               samples[resent].value != instance->pending[i].value){
+                instance->errors++;
+                break;
+            }
+        }
+        instance->requeue_dropped += first;
+        instance->n_pending = 0;
+        resent_stored = instance->pending_stored;
+    }
+
+    lost = instance->attempts++ % UNACKED_FRAMES == UNACKED_FRAMES - 1;
+    if(lost){
+        //every other unacked frame is stored by the server, only its ack is lost, starting with the odd instances
+        stored = (instance->unacked++ + instance->deviceId) % 2 == 1;
+        memcpy(instance->pending, samples, batch.count * sizeof(struct sensor));
+        instance->n_pending = batch.count;
+        instance->pending_stored = stored;
+    }
+    if(!stored){
+        return -1;
+    }
+
+    instance->frames++;
+    instance->bytes += frame_len;
+    if(instance->last_mode >= 0 && batch.mode != instance->last_mode){
+        instance->mode_changes++;
+    }
+    instance->last_mode = batch.mode;
+    for(uint16_t i = 0; i < batch.count; i++){
+        struct sensor *sample = &samples[i];
+        int axis = sample->measurementType - (instance->vibration ? 2 : 1);
+        if(sample->deviceId != instance->deviceId || axis < 0 || axis >= (instance->vibration ? AXES : 1)){
+            instance->errors++;
+            continue;
+        }
+        //the server already has the samples of a stored frame, it drops them by sequence number
+        if(i < resent && resent_stored){
+            instance->duplicates++;
+            continue;
+        }
+        //each stream is numbered on its own, so the server can interpolate it
+        if((int64_t)sample->sequence <= instance->last_sequence[axis]){
+            instance->errors++;
+        }
+        instance->last_sequence[axis] = sample->sequence;
+        instance->sent++;
+    }
+    if(lost){
+        return -1;
+    }
+
+    //ack without policy delta, with the echo of the send time, and no hold as the batch is not logged
+    if(ack_len < FRAME_POLICY_SIZE){
+        return 0;
+    }
+    memset(ack, 0, FRAME_POLICY_SIZE);
+    memcpy(&ack[0], &magic, sizeof(uint32_t));
+    memcpy(&ack[20], &batch.send_time, sizeof(int64_t));
+    return FRAME_POLICY_SIZE;
+}
+
+
+static void *sensor_thread(void *arg){
+
+    struct instance *instance = arg;
+    unsigned int seed = 1000u + (unsigned int)instance->deviceId;
+    struct sensor sample = { instance->deviceId, instance->vibration ? 2 : 1, 0.0f, 0, 0, 0 };
+    long i = 0;
+
+    while(instance->running){
+        for(int axis = 0; axis < (instance->vibration ? AXES : 1); axis++){
+            float noise = ((float)(rand_r(&seed) % 201) - 100.0f) / 1000.0f;
+            if(instance->vibration){
+                sample.measurementType = 2 + axis;
+                sample.value = 10.0f + sinf(2.0f * (float)M_PI * 5.0f * (float)i * VIBRATION_PERIOD / 1e6f + (float)axis) + noise;
+            }else{
+                sample.value = 25.0f + 2.0f * sinf((float)i / 50.0f) + noise;
+            }
+            driver_submit(instance->handle, sample);
+            instance->submitted++;
+            instance->submitted_of[axis]++;
+        }
+        i++;
+        usleep(instance->vibration ? VIBRATION_PERIOD : ENVIRONMENT_PERIOD);
+    }
+    return NULL;
+}
+
+
+static bool instance_create(struct instance *instance, int deviceId){
+
+    struct driver_config config;
+
+    memset(instance, 0, sizeof(*instance));
+    instance->deviceId = deviceId;
+    instance->vibration = deviceId % 2 == 0;
+    for(int axis = 0; axis < AXES; axis++){
+        instance->last_sequence[axis] = -1;
+    }
+    instance->last_mode = -1;
+    snprintf(instance->name, sizeof(instance->name), "%s%d", instance->vibration ? "vib" : "env", deviceId);
+
+    driver_config_default(&config);
+    config.name = instance->name;
+    config.transport = transport_check;
+    config.transport_ctx = instance;
+    config.policy.max_time = MIN_TIME;
+    if(instance->vibration){
+        //aggressive compression, full frames
+        config.buffer_size = TRANSMISSION_BUFFER_SIZE;
+        config.policy.transmission_buffer_size = TRANSMISSION_BUFFER_SIZE;
+        config.policy.max_length = MAX_LENGHT_LIMIT_OF(TRANSMISSION_BUFFER_SIZE);
+        config.policy.compression_mode = COMPRESSION_SWINGING_DOOR;
+        config.policy.sdt_deviation = 0.2f;
+        config.policy.tolerance_percentage = 50;
+        config.policy.tolerance_percentage_critical = 100;
+    }else{
+        //small buffer, long batching
+        config.buffer_size = 256;
+        config.policy.transmission_buffer_size = 256;
+        config.policy.max_length = MAX_LENGHT_LIMIT_OF(256);
+        config.policy.compression_mode = COMPRESSION_DEADBAND;
+        config.policy.tolerance_percentage = 1;
+        config.policy.tolerance_percentage_critical = 50;
+    }
+    instance->frame_size = config.policy.transmission_buffer_size;
+
+    instance->handle = driver_create(&config);
+    return instance->handle != NULL;
+}
+
+
+int main(int argc, char **argv){
+
+    static struct instance instances[MAX_INSTANCES];
+    int n = argc > 1 ? atoi(argv[1]) : 16;
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+    long submitted = 0, sent = 0, frames = 0, unacked = 0, duplicates = 0, requeue_dropped = 0, bytes = 0, errors = 0;
+
+    if(n < 1 || n > MAX_INSTANCES || seconds < 1){
+        fprintf(stderr, "usage: %s [instances 1..%d] [seconds]\n", argv[0], MAX_INSTANCES);
+        return 1;
+    }
+
+    for(int i = 0; i < n; i++){
+        if(!instance_create(&instances[i], i)){
+            fprintf(stderr, "driver_create failed for instance %d\n", i);
+            return 1;
+        }
+        instances[i].running = true;
+        pthread_create(&instances[i].sensor, NULL, sensor_thread, &instances[i]);
+    }
+
+    usleep((useconds_t)seconds * 500000);
+    //switch the mode with samples in the queues
+    for(int i = 0; i < n; i++){
+        struct driver_policy policy;
+        if(!instances[i].vibration){
+            driver_policy_get(instances[i].handle, &policy);
+            policy.compression_mode = COMPRESSION_SWINGING_DOOR;
+            driver_policy_set(instances[i].handle, &policy);
+        }
+    }
+    usleep((useconds_t)seconds * 500000);
+
+    //stop the sensors, then the instances send what is left in their queues
+    for(int i = 0; i < n; i++){
+        instances[i].running = false;
+        pthread_join(instances[i].sensor, NULL);
+        driver_destroy(instances[i].handle);
+    }
+
+    printf("%d instances, %d s\n\n", n, seconds);
+    printf("%-8s %-13s %10s %8s %7s %8s %8s %12s %7s\n", "name", "mode", "submitted", "sent", "frames", "unacked",
+           "bytes", "samples/frm", "errors");
+    for(int i = 0; i < n; i++){
+        struct instance *instance = &instances[i];
+        //in swinging-door mode the last sample of each stream is always sent, it closes the last segment
+        for(int axis = 0; axis < (instance->vibration ? AXES : 1); axis++){
+            if(instance->last_sequence[axis] != instance->submitted_of[axis] - 1){
+                instance->errors++;
+            }
+        }
+        //the frames of the old mode are all sent before the ones of the new mode
+        if(instance->mode_changes != (instance->vibration ? 0 : 1)){
+            instance->errors++;
+        }
+        //the samples of a lost frame must have been sent again
+        if(instance->n_pending > 0 && !instance->pending_stored){
+            instance->errors++;
+        }
+        printf("%-8s %-13s %10ld %8ld %7ld %8ld %8ld %12.1f %7ld\n", instance->name,
+               instance->vibration ? "swinging_door" : "deadband->sdt", instance->submitted, instance->sent,
+               instance->frames, instance->unacked, instance->bytes,
+               instance->frames ? (double)instance->sent / instance->frames : 0.0, instance->errors);
+        submitted += instance->submitted;
+        sent += instance->sent;
+        frames += instance->frames;
+        unacked += instance->unacked;
+        duplicates += instance->duplicates;
+        requeue_dropped += instance->requeue_dropped;
+        bytes += instance->bytes;
+        errors += instance->errors;
+    }
+    printf("\ntotal: %ld submitted, %ld sent, %ld frames, %ld unacked, %ld duplicates, %ld dropped on requeue, %ld bytes, "
+           "%ld errors\n", submitted, sent, frames, unacked, duplicates, requeue_dropped, bytes, errors);
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,305 @@
+/*
+ * Host micro-benchmarks of the per-sample paths of the driver.
+ *
+ * Each kernel runs over the same trace, a few times, and the fastest run is
+ * reported in nanoseconds per sample, as JSON on stdout, so the results can be
+ * compared with a stored baseline by bench_compare.py (make microbench).
+ *
+ *   classify         OUTSIDE_TOLERANCE_PCT of process_sensor_data(), with the
+ *                    reference updated as in dead-band mode
+ *   swinging_door    sdt_process() of the swinging-door mode
+ *   record_copy      frame_batch_record() into transmission_buffer, with the
+ *                    header of each full frame, as in transmission_flush()
+ *   queue            xQueueSend() and xQueueReceive() of the samples, in
+ *                    batches of MAX_LENGHT_LIMIT (pthread port of FreeRTOS)
+ *   batch_decode     frame_batch_decode_header() and frame_batch_decode_record()
+ *   aggregate_encode frame_aggregator_add() and frame_aggregator_encode()
+ *
+ * A fixed loop that does not depend on the driver, the calibration, runs right
+ * before every run of a kernel. The median ratio of each kernel to it is
+ * reported as "relative", which bench_compare.py compares, so a busier or
+ * idler host, or another machine, does not show as a change of the code.
+ *
+ * Usage: micro_bench [samples] [runs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver.h"
+#include "frame.h"
+#include "compression.h"
+
+#define STREAMS (4)
+
+/**
+ * @brief One kernel of the benchmark.
+ */
+struct kernel {
+  const char *name;
+  uint32_t (*run)(long n);   /**< Processes the first n samples of the trace, returns a checksum. */
+};
+
+/**
+ * Trace of the benchmark, generated once.
+ */
+static struct sensor *trace;
+
+/**
+ * Frames of the trace encoded by the driver, input of batch_decode.
+ */
+static uint8_t *encoded;
+static size_t encoded_len;
+
+/**
+ * Keeps the results of the kernels alive.
+ */
+static volatile uint32_t sink;
+
+
+static uint32_t kernel_calibration(long n){
+
+    uint32_t state = 1;
+
+    for(long i = 0; i < n; i++){
+        state ^= trace[i].sequence;
+        state = state * 1664525u + 1013904223u;
+        state ^= state >> 13;
+    }
+    return state;
+}
+
+
+static uint32_t kernel_classify(long n){
+
+    float reference = INFINITY;
+    uint32_t sent = 0;
+
+    for(long i = 0; i < n; i++){
+        uint8_t threshold_result = OUTSIDE_TOLERANCE_PCT(trace[i].value, reference,
+                                                         MEASURE_TOLERANCE_PERCENTAGE,
+                                                         MEASURE_TOLERANCE_PERCENTAGE_CRITICAL);
+        if(threshold_result){
+            reference = trace[i].value;
+            sent += threshold_result;
+        }
+    }
+    return sent;
+}
+
+
+static uint32_t kernel_swinging_door(long n){
+
+    struct sdt_state sdt;
+    struct sensor endpoint;
+    uint32_t sent = 0;
+
+    sdt_reset(&sdt);
+    for(long i = 0; i < n; i++){
+        if(sdt_process(&sdt, 0.2f, &trace[i], &endpoint)){
+            sent += endpoint.sequence;
+        }
+    }
+    return sent;
+}
+
+
+static uint32_t kernel_record_copy(long n){
+
+    static uint8_t transmission_buffer[TRANSMISSION_BUFFER_SIZE];
+    struct frame_batch batch = { .mode = COMPRESSION_DEADBAND, .flags = FRAME_FLAGS };
+    size_t buffer_index = FRAME_BATCH_HEADER_SIZE(batch.flags);
+    uint32_t frames = 0;
+
+    for(long i = 0; i < n; i++){
+        if(batch.count == 0){
+            batch.base_time = trace[i].timestamp;
+        }
+        buffer_index += frame_batch_record(&transmission_buffer[buffer_index], &batch, &trace[i]);
+        batch.count++;
+        if(buffer_index + FRAME_BATCH_RECORD_SIZE(batch.flags) > sizeof(transmission_buffer)){
+            frame_batch_header(transmission_buffer, &batch);
+            //read back, so the copy is not optimized out
+            frames += transmission_buffer[buffer_index - 1];
+            buffer_index = FRAME_BATCH_HEADER_SIZE(batch.flags);
+            batch.count = 0;
+        }
+    }
+    return frames;
+}
+
+
+static uint32_t kernel_queue(long n){
+
+    static QueueHandle_t xQueue;
+    struct sensor received;
+    uint32_t sum = 0;
+
+    if(xQueue == NULL){
+        xQueue = xQueueCreate(MAX_LENGHT_LIMIT, sizeof(struct sensor));
+    }
+    for(long i = 0; i < n; i += MAX_LENGHT_LIMIT){
+        long end = i + MAX_LENGHT_LIMIT < n ? i + MAX_LENGHT_LIMIT : n;
+        for(long j = i; j < end; j++){
+            xQueueSend(xQueue, &trace[j], 0);
+        }
+        while(xQueueReceive(xQueue, &received, 0) == pdPASS){
+            sum += received.sequence;
+        }
+    }
+    return sum;
+}
+
+
+static uint32_t kernel_batch_decode(long n){
+
+    struct frame_batch batch;
+    struct sensor sample;
+    size_t offset = 0;
+    long decoded = 0;
+    uint32_t sum = 0;
+
+    while(decoded < n && offset < encoded_len && frame_batch_decode_header(&encoded[offset], encoded_len - offset, &batch)){
+        const uint8_t *record = &encoded[offset + FRAME_BATCH_HEADER_SIZE(batch.flags)];
+        for(uint16_t i = 0; i < batch.count; i++){
+            frame_batch_decode_record(record, &batch, &sample);
+            sum += sample.sequence;
+            record += FRAME_BATCH_RECORD_SIZE(batch.flags);
+        }
+        decoded += batch.count;
+        offset += FRAME_BATCH_HEADER_SIZE(batch.flags) + batch.count * FRAME_BATCH_RECORD_SIZE(batch.flags);
+    }
+    return sum;
+}
+
+
+static uint32_t kernel_aggregate_encode(long n){
+
+    static struct frame_aggregator agg;
+    static uint8_t frame[TRANSMISSION_BUFFER_SIZE];
+    uint32_t bytes = 0;
+
+    frame_aggregator_init(&agg, FRAME_FLAGS);
+    for(long i = 0; i < n; i++){
+        if(!frame_aggregator_add(&agg, &trace[i], COMPRESSION_DEADBAND)){
+            bytes += frame_aggregator_encode(&agg, frame, sizeof(frame), 0);
+            frame_aggregator_add(&agg, &trace[i], COMPRESSION_DEADBAND);
+        }
+    }
+    bytes += frame_aggregator_encode(&agg, frame, sizeof(frame), 0);
+    return bytes;
+}
+
+
+/*
+ * Vibration of a few streams, interleaved as on an aggregator, with 1 ms between samples.
+ */
+static void trace_generate(long n){
+
+    unsigned int seed = 1;
+    uint32_t sequence[STREAMS] = { 0 };
+
+    trace = malloc((size_t)n * sizeof(*trace));
+    for(long i = 0; i < n; i++){
+        int stream = (int)(i % STREAMS);
+        float noise = ((float)(rand_r(&seed) % 201) - 100.0f) / 1000.0f;
+        trace[i].deviceId = stream;
+        trace[i].measurementType = 2;
+        trace[i].value = 10.0f + sinf(2.0f * (float)M_PI * 5.0f * (float)(i / STREAMS) / 1000.0f) + noise;
+        trace[i].sequence = sequence[stream]++;
+        trace[i].timestamp = (int64_t)(i / STREAMS) * 1000;
+    }
+
+    //full frames, as sent by a standalone node
+    encoded = malloc((size_t)n * FRAME_BATCH_RECORD_SIZE(FRAME_FLAGS) + ((size_t)n / MAX_LENGHT_LIMIT + 1) * FRAME_BATCH_HEADER_SIZE(FRAME_FLAGS));
+    encoded_len = 0;
+    for(long i = 0; i < n; i += MAX_LENGHT_LIMIT){
+        struct frame_batch batch = { .mode = COMPRESSION_DEADBAND, .flags = FRAME_FLAGS, .base_time = trace[i].timestamp };
+        size_t header = encoded_len;
+        encoded_len += FRAME_BATCH_HEADER_SIZE(batch.flags);
+        for(long j = i; j < n && j < i + MAX_LENGHT_LIMIT; j++){
+            encoded_len += frame_batch_record(&encoded[encoded_len], &batch, &trace[j]);
+            batch.count++;
+        }
+        frame_batch_header(&encoded[header], &batch);
+    }
+}
+
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end){
+    return (double)(end->tv_sec - start->tv_sec) * 1e9 + (double)(end->tv_nsec - start->tv_nsec);
+}
+
+
+static int compare_double(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+int main(int argc, char **argv){
+
+    static const struct kernel kernels[] = {
+        { "classify", kernel_classify },
+        { "swinging_door", kernel_swinging_door },
+        { "record_copy", kernel_record_copy },
+        { "queue", kernel_queue },
+        { "batch_decode", kernel_batch_decode },
+        { "aggregate_encode", kernel_aggregate_encode },
+    };
+    const size_t n_kernels = sizeof(kernels) / sizeof(kernels[0]);
+    double best[sizeof(kernels) / sizeof(kernels[0])];
+    double relative[sizeof(kernels) / sizeof(kernels[0])];
+    double calibration = INFINITY;
+    double *ratios;
+    long n = argc > 1 ? atol(argv[1]) : 200000;
+    int runs = argc > 2 ? atoi(argv[2]) : 15;
+
+    if(n < MAX_LENGHT_LIMIT || runs < 1){
+        fprintf(stderr, "usage: %s [samples >= %d] [runs]\n", argv[0], MAX_LENGHT_LIMIT);
+        return 1;
+    }
+    trace_generate(n);
+
+    ratios = malloc((size_t)runs * sizeof(*ratios));
+    for(size_t k = 0; k < n_kernels; k++){
+        best[k] = INFINITY;
+        //the first run warms up the caches and is not counted
+        for(int r = 0; r <= runs; r++){
+            struct timespec start, middle, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            sink = kernel_calibration(n);
+            clock_gettime(CLOCK_MONOTONIC, &middle);
+            sink = kernels[k].run(n);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if(r > 0){
+                calibration = fmin(calibration, elapsed_ns(&start, &middle));
+                best[k] = fmin(best[k], elapsed_ns(&middle, &end));
+                ratios[r - 1] = elapsed_ns(&middle, &end) / elapsed_ns(&start, &middle);
+            }
+        }
+        qsort(ratios, (size_t)runs, sizeof(*ratios), compare_double);
+        relative[k] = runs % 2 ? ratios[runs / 2] : (ratios[runs / 2 - 1] + ratios[runs / 2]) / 2.0;
+    }
+    free(ratios);
+
+    printf("{\n  \"suite\": \"driver\",\n  \"unit\": \"ns/sample\",\n  \"samples\": %ld,\n  \"runs\": %d,\n"
+           "  \"results\": {\n", n, runs);
+    for(size_t k = 0; k < n_kernels; k++){
+        printf("    \"%s\": %.3f,\n", kernels[k].name, best[k] / (double)n);
+    }
+    printf("    \"calibration\": %.3f\n  },\n  \"relative\": {\n", calibration / (double)n);
+    for(size_t k = 0; k < n_kernels; k++){
+        printf("    \"%s\": %.4f%s\n", kernels[k].name, relative[k], k + 1 < n_kernels ? "," : "");
+    }
+    printf("  }\n}\n");
+
+    free(trace);
+    free(encoded);
+    return 0;
+}
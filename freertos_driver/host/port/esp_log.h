@@ -0,0 +1,18 @@
+/*
+ * @brief Host port of the ESP-IDF log, printed only when built with PORT_LOG
+ */
+
+
+#ifndef _PORT_ESP_LOG_H_
+#define _PORT_ESP_LOG_H_
+
+#include <stdio.h>
+
+#ifdef PORT_LOG
+#define ESP_LOGI(tag, format, ...) printf("I (%s) " format "\n", tag, ##__VA_ARGS__)
+#else
+#define ESP_LOGI(tag, format, ...) do{}while(0)
+#endif
+
+
+#endif
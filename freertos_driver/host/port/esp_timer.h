@@ -0,0 +1,15 @@
+/*
+ * @brief Host port of the ESP-IDF high resolution timer
+ */
+
+
+#ifndef _PORT_ESP_TIMER_H_
+#define _PORT_ESP_TIMER_H_
+
+#include <stdint.h>
+
+/* Microseconds of the monotonic clock of the host */
+int64_t esp_timer_get_time(void);
+
+
+#endif
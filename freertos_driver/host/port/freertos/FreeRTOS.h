@@ -0,0 +1,39 @@
+/*
+ * @brief Host port of the FreeRTOS API used by the driver
+ *
+ * Implements the tasks, queues, semaphores and timers of FreeRTOS on top of
+ * pthreads, so driver.c can run unchanged in host simulations. Only the calls
+ * used by the driver are provided, with one tick per millisecond.
+ */
+
+
+#ifndef _PORT_FREERTOS_H_
+#define _PORT_FREERTOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdPASS  (1)
+#define pdFAIL  (0)
+#define pdTRUE  (1)
+#define pdFALSE (0)
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define portTICK_PERIOD_MS (1)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configMAX_PRIORITIES (25)
+
+/* The spinlocks of ESP-IDF are plain mutexes on the host */
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portMUX_INITIALIZE(mux) pthread_mutex_init((mux), NULL)
+#define taskENTER_CRITICAL(mux) pthread_mutex_lock(mux)
+#define taskEXIT_CRITICAL(mux) pthread_mutex_unlock(mux)
+
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * @brief Host port of the FreeRTOS semaphores, see FreeRTOS.h
+ */
+
+
+#ifndef _PORT_SEMPHR_H_
+#define _PORT_SEMPHR_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct port_semaphore *SemaphoreHandle_t;
+
+/* A mutex is a binary semaphore created given, without priority inheritance */
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore);
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore);
+
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * @brief Host port of the FreeRTOS tasks, see FreeRTOS.h
+ */
+
+
+#ifndef _PORT_TASK_H_
+#define _PORT_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct port_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/* The stack size, priority and core are ignored, every task is a thread */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask,
+                                   BaseType_t xCoreID);
+void vTaskDelete(TaskHandle_t xTask);
+void vTaskDelay(TickType_t xTicksToDelay);
+TickType_t xTaskGetTickCount(void);
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify);
+
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * @brief Host port of the FreeRTOS software timers, see FreeRTOS.h
+ *
+ * As in FreeRTOS, the callbacks and the pended functions run one at a time in
+ * a single timer service thread.
+ */
+
+
+#ifndef _PORT_TIMERS_H_
+#define _PORT_TIMERS_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct port_timer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t xTimer);
+typedef void (*PendedFunction_t)(void *, uint32_t);
+
+TimerHandle_t xTimerCreate(const char *pcTimerName, TickType_t xTimerPeriod, UBaseType_t uxAutoReload,
+                           void *pvTimerID, TimerCallbackFunction_t pxCallbackFunction);
+BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait);
+BaseType_t xTimerReset(TimerHandle_t xTimer, TickType_t xTicksToWait);
+BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait);
+BaseType_t xTimerChangePeriod(TimerHandle_t xTimer, TickType_t xNewPeriod, TickType_t xTicksToWait);
+BaseType_t xTimerDelete(TimerHandle_t xTimer, TickType_t xTicksToWait);
+void *pvTimerGetTimerID(TimerHandle_t xTimer);
+BaseType_t xTimerPendFunctionCall(PendedFunction_t xFunctionToPend, void *pvParameter1, uint32_t ulParameter2,
+                                  TickType_t xTicksToWait);
+
+
+#endif
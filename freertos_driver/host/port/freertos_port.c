@@ -0,0 +1,770 @@
+/*
+ * Host port of the FreeRTOS and ESP-IDF calls used by the driver.
+ *
+ * Every task is a thread, the task notifications, queues and semaphores are
+ * built on a mutex and a condition variable, and the software timers run in
+ * one service thread, as the timer task of FreeRTOS does.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#define PORT_MAX_TIMERS (256)
+#define PORT_MAX_PENDED (64)
+#define PORT_MAX_NVS_ENTRIES (64)
+#define PORT_NVS_NAME_SIZE (16)
+
+/**
+ * @brief A task, with its notification value.
+ */
+struct port_task {
+  pthread_t thread;
+  TaskFunction_t code;
+  void *parameters;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t notification;
+  bool deleted;
+};
+
+/**
+ * @brief A queue of fixed size items.
+ */
+struct port_queue {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head;
+  UBaseType_t count;
+  uint8_t *items;
+};
+
+/**
+ * @brief A counting semaphore, used for the mutexes and the binary semaphores.
+ */
+struct port_semaphore {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  UBaseType_t count;
+  UBaseType_t max;
+};
+
+/**
+ * @brief A software timer, owned by the timer service thread.
+ */
+struct port_timer {
+  TickType_t period;
+  bool auto_reload;
+  bool active;
+  int64_t expiry;  /**< Microseconds of esp_timer_get_time(). */
+  void *id;
+  TimerCallbackFunction_t callback;
+};
+
+/**
+ * @brief A call pended to the timer service thread.
+ */
+struct port_pended {
+  PendedFunction_t function;
+  void *parameter1;
+  uint32_t parameter2;
+};
+
+/**
+ * @brief A blob stored in the NVS.
+ */
+struct port_nvs_entry {
+  char name[PORT_NVS_NAME_SIZE];
+  char key[PORT_NVS_NAME_SIZE];
+  void *value;
+  size_t length;
+};
+
+
+/*-----------------------------------------------------------
+ * GLOBAL VARIABLES
+ *----------------------------------------------------------*/
+/** Task running on the current thread, NULL on threads not created by the port. */
+static __thread struct port_task *current_task;
+
+/** State of the timer service, protected by timer_mutex. */
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static struct port_timer *timers[PORT_MAX_TIMERS];
+static struct port_pended pended[PORT_MAX_PENDED];
+static size_t n_pended;
+
+/** Blobs of the NVS, protected by nvs_mutex. */
+static pthread_mutex_t nvs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct port_nvs_entry nvs_entries[PORT_MAX_NVS_ENTRIES];
+
+
+/*-----------------------------------------------------------
+ * TIME
+ *----------------------------------------------------------*/
+int64_t esp_timer_get_time(void){
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+TickType_t xTaskGetTickCount(void){
+    return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+
+/*
+ * Waits on cond until the predicate of the caller holds or the ticks expire.
+ *
+ * @return false on timeout.
+ */
+static bool port_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline){
+
+    if(deadline == NULL){
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+
+/*
+ * Converts a block time into a deadline of CLOCK_REALTIME, NULL if it never expires.
+ */
+static const struct timespec *port_deadline(TickType_t ticks, struct timespec *deadline){
+
+    if(ticks == portMAX_DELAY){
+        return NULL;
+    }
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ticks / 1000;
+    deadline->tv_nsec += (long)(ticks % 1000) * 1000000;
+    if(deadline->tv_nsec >= 1000000000){
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+    return deadline;
+}
+
+
+/*-----------------------------------------------------------
+ * TASKS
+ *----------------------------------------------------------*/
+static void *port_task_run(void *arg){
+
+    current_task = arg;
+    current_task->code(current_task->parameters);
+    //a FreeRTOS task must not return, it deletes itself
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask,
+                                   BaseType_t xCoreID){
+
+    struct port_task *task = calloc(1, sizeof(*task));
+
+    (void)pcName;
+    (void)usStackDepth;
+    (void)uxPriority;
+    (void)xCoreID;
+
+    if(task == NULL){
+        return pdFAIL;
+    }
+    task->code = pvTaskCode;
+    task->parameters = pvParameters;
+    pthread_mutex_init(&task->mutex, NULL);
+    pthread_cond_init(&task->cond, NULL);
+    if(pxCreatedTask != NULL){
+        *pxCreatedTask = task;
+    }
+    if(pthread_create(&task->thread, NULL, port_task_run, task) != 0){
+        free(task);
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+
+void vTaskDelete(TaskHandle_t xTask){
+
+    if(xTask == NULL || xTask == current_task){
+        //the thread can not join itself, its resources are released on exit
+        pthread_detach(pthread_self());
+        pthread_exit(NULL);
+    }
+
+    //the task leaves at its next blocking call on a notification
+    pthread_mutex_lock(&xTask->mutex);
+    xTask->deleted = true;
+    pthread_cond_signal(&xTask->cond);
+    pthread_mutex_unlock(&xTask->mutex);
+    pthread_join(xTask->thread, NULL);
+    pthread_mutex_destroy(&xTask->mutex);
+    pthread_cond_destroy(&xTask->cond);
+    free(xTask);
+}
+
+
+void vTaskDelay(TickType_t xTicksToDelay){
+    usleep((useconds_t)xTicksToDelay * 1000);
+}
+
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait){
+
+    struct port_task *task = current_task;
+    struct timespec deadline;
+    const struct timespec *until = port_deadline(xTicksToWait, &deadline);
+    uint32_t value;
+
+    pthread_mutex_lock(&task->mutex);
+    while(task->notification == 0 && !task->deleted){
+        if(!port_wait(&task->cond, &task->mutex, until)){
+            break;
+        }
+    }
+    if(task->deleted){
+        pthread_mutex_unlock(&task->mutex);
+        pthread_exit(NULL);
+    }
+    value = task->notification;
+    if(xClearCountOnExit){
+        task->notification = 0;
+    }else if(value > 0){
+        task->notification--;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return value;
+}
+
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify){
+
+    pthread_mutex_lock(&xTaskToNotify->mutex);
+    xTaskToNotify->notification++;
+    pthread_cond_signal(&xTaskToNotify->cond);
+    pthread_mutex_unlock(&xTaskToNotify->mutex);
+    return pdPASS;
+}
+
+
+/*-----------------------------------------------------------
+ * QUEUES
+ *----------------------------------------------------------*/
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize){
+
+    struct port_queue *queue = calloc(1, sizeof(*queue));
+
+    if(queue == NULL || uxQueueLength == 0){
+        free(queue);
+        return NULL;
+    }
+    queue->items = malloc((size_t)uxQueueLength * uxItemSize);
+    if(queue->items == NULL){
+        free(queue);
+        return NULL;
+    }
+    queue->length = uxQueueLength;
+    queue->item_size = uxItemSize;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    return queue;
+}
+
+
+/*
+ * Adds an item at the back or at the front of the queue.
+ */
+static BaseType_t port_queue_send(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait,
+                                  bool front){
+
+    struct timespec deadline;
+    const struct timespec *until = xTicksToWait ? port_deadline(xTicksToWait, &deadline) : NULL;
+
+    pthread_mutex_lock(&xQueue->mutex);
+    while(xQueue->count == xQueue->length){
+        if(xTicksToWait == 0 || !port_wait(&xQueue->cond, &xQueue->mutex, until)){
+            pthread_mutex_unlock(&xQueue->mutex);
+            return pdFAIL;
+        }
+    }
+    if(front){
+        xQueue->head = (xQueue->head + xQueue->length - 1) % xQueue->length;
+        memcpy(&xQueue->items[xQueue->head * xQueue->item_size], pvItemToQueue, xQueue->item_size);
+    }else{
+        memcpy(&xQueue->items[((xQueue->head + xQueue->count) % xQueue->length) * xQueue->item_size],
+               pvItemToQueue, xQueue->item_size);
+    }
+    xQueue->count++;
+    pthread_cond_broadcast(&xQueue->cond);
+    pthread_mutex_unlock(&xQueue->mutex);
+    return pdPASS;
+}
+
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait){
+    return port_queue_send(xQueue, pvItemToQueue, xTicksToWait, false);
+}
+
+
+BaseType_t xQueueSendToFront(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait){
+    return port_queue_send(xQueue, pvItemToQueue, xTicksToWait, true);
+}
+
+
+/*
+ * Copies the item at the front of the queue, and removes it unless peek.
+ */
+static BaseType_t port_queue_receive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait, bool peek){
+
+    struct timespec deadline;
+    const struct timespec *until = xTicksToWait ? port_deadline(xTicksToWait, &deadline) : NULL;
+
+    pthread_mutex_lock(&xQueue->mutex);
+    while(xQueue->count == 0){
+        if(xTicksToWait == 0 || !port_wait(&xQueue->cond, &xQueue->mutex, until)){
+            pthread_mutex_unlock(&xQueue->mutex);
+            return pdFAIL;
+        }
+    }
+    memcpy(pvBuffer, &xQueue->items[xQueue->head * xQueue->item_size], xQueue->item_size);
+    if(!peek){
+        xQueue->head = (xQueue->head + 1) % xQueue->length;
+        xQueue->count--;
+        pthread_cond_broadcast(&xQueue->cond);
+    }
+    pthread_mutex_unlock(&xQueue->mutex);
+    return pdPASS;
+}
+
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait){
+    return port_queue_receive(xQueue, pvBuffer, xTicksToWait, false);
+}
+
+
+BaseType_t xQueuePeek(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait){
+    return port_queue_receive(xQueue, pvBuffer, xTicksToWait, true);
+}
+
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue){
+
+    UBaseType_t count;
+
+    pthread_mutex_lock(&xQueue->mutex);
+    count = xQueue->count;
+    pthread_mutex_unlock(&xQueue->mutex);
+    return count;
+}
+
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t xQueue){
+
+    UBaseType_t spaces;
+
+    pthread_mutex_lock(&xQueue->mutex);
+    spaces = xQueue->length - xQueue->count;
+    pthread_mutex_unlock(&xQueue->mutex);
+    return spaces;
+}
+
+
+BaseType_t xQueueReset(QueueHandle_t xQueue){
+
+    pthread_mutex_lock(&xQueue->mutex);
+    xQueue->head = 0;
+    xQueue->count = 0;
+    pthread_cond_broadcast(&xQueue->cond);
+    pthread_mutex_unlock(&xQueue->mutex);
+    return pdPASS;
+}
+
+
+void vQueueDelete(QueueHandle_t xQueue){
+
+    pthread_mutex_destroy(&xQueue->mutex);
+    pthread_cond_destroy(&xQueue->cond);
+    free(xQueue->items);
+    free(xQueue);
+}
+
+
+/*-----------------------------------------------------------
+ * SEMAPHORES
+ *----------------------------------------------------------*/
+static SemaphoreHandle_t port_semaphore_create(UBaseType_t count, UBaseType_t max){
+
+    struct port_semaphore *semaphore = calloc(1, sizeof(*semaphore));
+
+    if(semaphore == NULL){
+        return NULL;
+    }
+    semaphore->count = count;
+    semaphore->max = max;
+    pthread_mutex_init(&semaphore->mutex, NULL);
+    pthread_cond_init(&semaphore->cond, NULL);
+    return semaphore;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void){
+    return port_semaphore_create(1, 1);
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void){
+    return port_semaphore_create(0, 1);
+}
+
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait){
+
+    struct timespec deadline;
+    const struct timespec *until = xTicksToWait ? port_deadline(xTicksToWait, &deadline) : NULL;
+
+    pthread_mutex_lock(&xSemaphore->mutex);
+    while(xSemaphore->count == 0){
+        if(xTicksToWait == 0 || !port_wait(&xSemaphore->cond, &xSemaphore->mutex, until)){
+            pthread_mutex_unlock(&xSemaphore->mutex);
+            return pdFAIL;
+        }
+    }
+    xSemaphore->count--;
+    pthread_mutex_unlock(&xSemaphore->mutex);
+    return pdPASS;
+}
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore){
+
+    BaseType_t result = pdFAIL;
+
+    pthread_mutex_lock(&xSemaphore->mutex);
+    if(xSemaphore->count < xSemaphore->max){
+        xSemaphore->count++;
+        pthread_cond_signal(&xSemaphore->cond);
+        result = pdPASS;
+    }
+    pthread_mutex_unlock(&xSemaphore->mutex);
+    return result;
+}
+
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore){
+
+    pthread_mutex_destroy(&xSemaphore->mutex);
+    pthread_cond_destroy(&xSemaphore->cond);
+    free(xSemaphore);
+}
+
+
+/*-----------------------------------------------------------
+ * TIMERS
+ *----------------------------------------------------------*/
+/*
+ * Timer service thread: runs the callbacks of the expired timers and the
+ * pended functions, one at a time and in order.
+ */
+static void *port_timer_service(void *arg){
+
+    struct timespec deadline;
+    struct port_pended call;
+    struct port_timer *expired;
+    TimerCallbackFunction_t callback;
+    int64_t now, next;
+
+    (void)arg;
+    pthread_mutex_lock(&timer_mutex);
+    while(true){
+        //the pended functions run before the timers, like the commands of the timer queue
+        if(n_pended > 0){
+            call = pended[0];
+            memmove(&pended[0], &pended[1], --n_pended * sizeof(pended[0]));
+            pthread_mutex_unlock(&timer_mutex);
+            call.function(call.parameter1, call.parameter2);
+            pthread_mutex_lock(&timer_mutex);
+            continue;
+        }
+
+        now = esp_timer_get_time();
+        next = INT64_MAX;
+        expired = NULL;
+        for(size_t i = 0; i < PORT_MAX_TIMERS; i++){
+            if(timers[i] != NULL && timers[i]->active){
+                if(timers[i]->expiry <= now){
+                    expired = timers[i];
+                    break;
+                }
+                if(timers[i]->expiry < next){
+                    next = timers[i]->expiry;
+                }
+            }
+        }
+
+        if(expired != NULL){
+            if(expired->auto_reload){
+                expired->expiry += (int64_t)expired->period * 1000;
+            }else{
+                expired->active = false;
+            }
+            //the timer can only be deleted by a command, which waits for this callback
+            callback = expired->callback;
+            pthread_mutex_unlock(&timer_mutex);
+            callback(expired);
+            pthread_mutex_lock(&timer_mutex);
+            continue;
+        }
+
+        if(next == INT64_MAX){
+            pthread_cond_wait(&timer_cond, &timer_mutex);
+        }else{
+            port_wait(&timer_cond, &timer_mutex, port_deadline((TickType_t)((next - now + 999) / 1000), &deadline));
+        }
+    }
+    return NULL;
+}
+
+
+static void port_timer_start_service(void){
+
+    pthread_t thread;
+
+    pthread_create(&thread, NULL, port_timer_service, NULL);
+    pthread_detach(thread);
+}
+
+
+TimerHandle_t xTimerCreate(const char *pcTimerName, TickType_t xTimerPeriod, UBaseType_t uxAutoReload,
+                           void *pvTimerID, TimerCallbackFunction_t pxCallbackFunction){
+
+    struct port_timer *timer;
+
+    (void)pcTimerName;
+    pthread_once(&timer_once, port_timer_start_service);
+
+    timer = calloc(1, sizeof(*timer));
+    if(timer == NULL){
+        return NULL;
+    }
+    timer->period = xTimerPeriod;
+    timer->auto_reload = uxAutoReload;
+    timer->id = pvTimerID;
+    timer->callback = pxCallbackFunction;
+
+    pthread_mutex_lock(&timer_mutex);
+    for(size_t i = 0; i < PORT_MAX_TIMERS; i++){
+        if(timers[i] == NULL){
+            timers[i] = timer;
+            pthread_mutex_unlock(&timer_mutex);
+            return timer;
+        }
+    }
+    pthread_mutex_unlock(&timer_mutex);
+    free(timer);
+    return NULL;
+}
+
+
+BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait){
+
+    (void)xTicksToWait;
+    pthread_mutex_lock(&timer_mutex);
+    xTimer->active = true;
+    xTimer->expiry = esp_timer_get_time() + (int64_t)xTimer->period * 1000;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mutex);
+    return pdPASS;
+}
+
+
+BaseType_t xTimerReset(TimerHandle_t xTimer, TickType_t xTicksToWait){
+    return xTimerStart(xTimer, xTicksToWait);
+}
+
+
+BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait){
+
+    (void)xTicksToWait;
+    pthread_mutex_lock(&timer_mutex);
+    xTimer->active = false;
+    pthread_mutex_unlock(&timer_mutex);
+    return pdPASS;
+}
+
+
+BaseType_t xTimerChangePeriod(TimerHandle_t xTimer, TickType_t xNewPeriod, TickType_t xTicksToWait){
+
+    pthread_mutex_lock(&timer_mutex);
+    xTimer->period = xNewPeriod;
+    pthread_mutex_unlock(&timer_mutex);
+    //as in FreeRTOS, changing the period also starts the timer
+    return xTimerStart(xTimer, xTicksToWait);
+}
+
+
+/*
+ * Deletes the timer in the service thread, after any callback in progress.
+ */
+static void port_timer_free(void *timer, uint32_t unused){
+
+    (void)unused;
+    free(timer);
+}
+
+
+BaseType_t xTimerDelete(TimerHandle_t xTimer, TickType_t xTicksToWait){
+
+    pthread_mutex_lock(&timer_mutex);
+    for(size_t i = 0; i < PORT_MAX_TIMERS; i++){
+        if(timers[i] == xTimer){
+            timers[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&timer_mutex);
+    return xTimerPendFunctionCall(port_timer_free, xTimer, 0, xTicksToWait);
+}
+
+
+void *pvTimerGetTimerID(TimerHandle_t xTimer){
+    return xTimer->id;
+}
+
+
+BaseType_t xTimerPendFunctionCall(PendedFunction_t xFunctionToPend, void *pvParameter1, uint32_t ulParameter2,
+                                  TickType_t xTicksToWait){
+
+    (void)xTicksToWait;
+    pthread_once(&timer_once, port_timer_start_service);
+
+    pthread_mutex_lock(&timer_mutex);
+    if(n_pended == PORT_MAX_PENDED){
+        pthread_mutex_unlock(&timer_mutex);
+        return pdFAIL;
+    }
+    pended[n_pended].function = xFunctionToPend;
+    pended[n_pended].parameter1 = pvParameter1;
+    pended[n_pended].parameter2 = ulParameter2;
+    n_pended++;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mutex);
+    return pdPASS;
+}
+
+
+/*-----------------------------------------------------------
+ * NVS
+ *----------------------------------------------------------*/
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle){
+
+    char *handle = calloc(1, PORT_NVS_NAME_SIZE);
+
+    (void)open_mode;
+    if(handle == NULL || strlen(name) >= PORT_NVS_NAME_SIZE){
+        free(handle);
+        return ESP_FAIL;
+    }
+    strcpy(handle, name);
+    *out_handle = (nvs_handle_t)handle;
+    return ESP_OK;
+}
+
+
+/*
+ * Looks for a blob, must be called with nvs_mutex taken.
+ */
+static struct port_nvs_entry *port_nvs_find(nvs_handle_t handle, const char *key){
+
+    for(size_t i = 0; i < PORT_MAX_NVS_ENTRIES; i++){
+        if(nvs_entries[i].value != NULL && strcmp(nvs_entries[i].name, (const char *)handle) == 0 &&
+           strcmp(nvs_entries[i].key, key) == 0){
+            return &nvs_entries[i];
+        }
+    }
+    return NULL;
+}
+
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length){
+
+    struct port_nvs_entry *entry;
+    esp_err_t result = ESP_OK;
+
+    pthread_mutex_lock(&nvs_mutex);
+    entry = port_nvs_find(handle, key);
+    if(entry == NULL){
+        result = ESP_ERR_NVS_NOT_FOUND;
+    }else if(out_value != NULL && *length < entry->length){
+        result = ESP_ERR_NVS_INVALID_LENGTH;
+    }else{
+        if(out_value != NULL){
+            memcpy(out_value, entry->value, entry->length);
+        }
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&nvs_mutex);
+    return result;
+}
+
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length){
+
+    struct port_nvs_entry *entry;
+    void *copy;
+
+    if(strlen(key) >= PORT_NVS_NAME_SIZE || (copy = malloc(length)) == NULL){
+        return ESP_FAIL;
+    }
+    memcpy(copy, value, length);
+
+    pthread_mutex_lock(&nvs_mutex);
+    entry = port_nvs_find(handle, key);
+    for(size_t i = 0; entry == NULL && i < PORT_MAX_NVS_ENTRIES; i++){
+        if(nvs_entries[i].value == NULL){
+            entry = &nvs_entries[i];
+            strcpy(entry->name, (const char *)handle);
+            strcpy(entry->key, key);
+        }
+    }
+    if(entry == NULL){
+        pthread_mutex_unlock(&nvs_mutex);
+        free(copy);
+        return ESP_FAIL;
+    }
+    free(entry->value);
+    entry->value = copy;
+    entry->length = length;
+    pthread_mutex_unlock(&nvs_mutex);
+    return ESP_OK;
+}
+
+
+esp_err_t nvs_commit(nvs_handle_t handle){
+
+    (void)handle;
+    return ESP_OK;
+}
+
+
+void nvs_close(nvs_handle_t handle){
+    free((void *)handle);
+}
@@ -0,0 +1,28 @@
+/*
+ * @brief Host port of the ESP-IDF NVS, kept in memory for the life of the process
+ */
+
+
+#ifndef _PORT_NVS_H_
+#define _PORT_NVS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int esp_err_t;
+typedef uintptr_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+#define ESP_OK (0)
+#define ESP_FAIL (-1)
+#define ESP_ERR_NVS_NOT_FOUND (0x1102)
+#define ESP_ERR_NVS_INVALID_LENGTH (0x110c)
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
+
+
+#endif
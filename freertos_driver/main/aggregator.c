@@ -0,0 +1,218 @@
+/*
+ * Aggregator mode of the transmission driver.
+ *
+ * Instead of every node opening its own connection to the server, the peer
+ * nodes send their batches to one aggregator node over UDP. The aggregator
+ * merges the batches of all the nodes, including its own, into frames of
+ * TRANSMISSION_BUFFER_SIZE bytes and forwards them upstream over a single
+ * persistent connection. The server then receives fewer and fuller frames.
+ *
+ * Durability: the aggregated path is best effort, unlike the acked batches of a
+ * standalone node. The peers send over UDP without an ack, so a datagram lost
+ * on the air is lost for good. The server does not ack the aggregated frames,
+ * so the aggregator only retries the last frame whose send failed locally, and
+ * drops the older one when a second frame fails before the retry succeeds.
+ * Samples pending in the aggregator are lost on a reset.
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver.h"
+#include "frame.h"
+#include "aggregator.h"
+#include "wifi.h"
+
+/*-----------------------------------------------------------
+ *DECLARATIONS PRIVATE
+ *----------------------------------------------------------*/
+static const char *TAG = "aggregator";
+
+/**
+ * @brief Samples pending to be forwarded upstream.
+ *
+ * Shared between the aggregator task and the transmission handler of the node,
+ * protected by xAggregatorMutex.
+ */
+static struct frame_aggregator pending;
+
+/**
+ * @brief Last frame whose send failed, retried before the next one.
+ *
+ * Protected by xAggregatorMutex.
+ */
+static uint8_t unsent_buffer[TRANSMISSION_BUFFER_SIZE];
+static size_t unsent_len;
+
+/**
+ * @brief Mutex for controlling access to the pending samples.
+ */
+static SemaphoreHandle_t xAggregatorMutex;
+
+/*-----------------------------------------------------------
+ * FUNCTION PROTOTYPE
+ *----------------------------------------------------------*/
+/**
+ * @brief Encodes the pending samples and forwards the frame upstream.
+ *
+ * Must be called with xAggregatorMutex taken.
+ */
+static void aggregator_flush(void);
+
+/**
+ * @brief Sends the frame kept by a failed flush again.
+ *
+ * Must be called with xAggregatorMutex taken.
+ *
+ * @return true if no frame is left unsent.
+ */
+static bool aggregator_retry(void);
+
+/**
+ * @brief Forwards the pending samples when the frame is full (see frame_forward_t).
+ */
+static void aggregator_forward(struct frame_aggregator *agg, void *ctx);
+
+/**
+ * @brief Adds the samples of one batch to the pending samples.
+ *
+ * Must be called with xAggregatorMutex taken.
+ */
+static void aggregator_add_batch(const uint8_t *data, size_t data_len);
+
+
+static bool aggregator_retry(void){
+
+    if(unsent_len > 0 && send_data_persistent(unsent_buffer, unsent_len) == 0){
+        unsent_len = 0;
+    }
+    return unsent_len == 0;
+}
+
+
+static void aggregator_flush(void){
+
+    static uint8_t frame_buffer[TRANSMISSION_BUFFER_SIZE];
+    size_t frame_len;
+    bool connected;
+
+    //the older frame goes first, so the server keeps the order of each node
+    connected = aggregator_retry();
+    frame_len = frame_aggregator_encode(&pending, frame_buffer, sizeof(frame_buffer), esp_timer_get_time());
+    if(frame_len == 0){
+        return;
+    }
+#ifdef DEBUG_MODE
+    ESP_LOGI(TAG, "Forwarding frame of %u bytes", (unsigned)frame_len);
+#endif
+    if(connected && send_data_persistent(frame_buffer, frame_len) == 0){
+        return;
+    }
+    //only one frame is kept, the server is still unreachable after the retry
+    if(unsent_len > 0){
+        ESP_LOGE(TAG, "dropping an unsent frame of %u bytes", (unsigned)unsent_len);
+    }
+    memcpy(unsent_buffer, frame_buffer, frame_len);
+    unsent_len = frame_len;
+}
+
+
+static void aggregator_forward(struct frame_aggregator *agg, void *ctx){
+    (void)agg;
+    (void)ctx;
+    aggregator_flush();
+}
+
+
+static void aggregator_add_batch(const uint8_t *data, size_t data_len){
+    frame_aggregator_add_batch(&pending, data, data_len, esp_timer_get_time(), aggregator_forward, NULL);
+}
+
+
+/*
+ * Receives the batches of the peer nodes and forwards the aggregated frames.
+ *
+ * @param pvParameter A pointer to the parameter passed to the function.
+ * This is not used in this function.
+ */
+void aggregator_handler(void *pvParameter)
+{
+    static uint8_t rx_buffer[TRANSMISSION_BUFFER_SIZE];
+    struct sockaddr_in listenAddr;
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    int sock;
+    int len;
+
+    listenAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    listenAddr.sin_family = AF_INET;
+    listenAddr.sin_port = htons( AGGREGATOR_PORT );
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(sock < 0 || bind(sock, (struct sockaddr *)&listenAddr, sizeof(listenAddr)) != 0){
+#ifdef DEBUG_MODE
+        ESP_LOGE(TAG, "error to bind the aggregator socket errno=%d", errno);
+#endif
+        while(1);
+    }
+    //wake up periodically to check the age of the pending frame
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while(true){
+
+        len = recvfrom(sock, rx_buffer, sizeof(rx_buffer), 0, NULL, NULL);
+
+        xSemaphoreTake(xAggregatorMutex, portMAX_DELAY);
+        if(len > 0){
+            aggregator_add_batch(rx_buffer, (size_t)len);
+        }
+        //do not let a partial frame wait forever
+        if(pending.n_samples > 0 &&
+           esp_timer_get_time() - pending.first_time >= (int64_t)AGGREGATOR_MAX_TIME * 1000){
+            aggregator_flush();
+        }
+        //a failed frame does not wait for the next flush when the peers are quiet
+        else if(len <= 0 && unsent_len > 0){
+            aggregator_retry();
+        }
+        xSemaphoreGive(xAggregatorMutex);
+    }
+}
+
+
+void aggregator_submit(const uint8_t *data, size_t data_len){
+
+    xSemaphoreTake(xAggregatorMutex, portMAX_DELAY);
+    aggregator_add_batch(data, data_len);
+    xSemaphoreGive(xAggregatorMutex);
+}
+
+
+void aggregator_init(void){
+
+#ifdef DEBUG_MODE
+    printf("Aggregator init..\n");
+#endif
+
+    frame_aggregator_init(&pending, FRAME_FLAGS);
+
+    //creating a mutex
+    xAggregatorMutex = xSemaphoreCreateMutex();
+    if(xAggregatorMutex == NULL){
+#ifdef DEBUG_MODE
+        ESP_LOGI(TAG,"erro to creat a mutex");
+#endif
+        while(1);
+    }
+
+    xTaskCreatePinnedToCore(                        // Use xTaskCreate() in vanilla FreeRTOS
+              aggregator_handler,                   // Function pointer to be called
+              "Task aggregator_handler",            // Name of task
+              aggregator_process_stack_size,        // Stack size (bytes in ESP32, words in FreeRTOS)
+              NULL,                                 // Parameter to pass to function
+              aggregator_process_priority,          // Task priority (0 to configMAX_PRIORITIES - 1)
+              NULL,                                 // Task handle
+              aggregator_process_CPU);
+}
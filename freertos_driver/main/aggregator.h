@@ -0,0 +1,43 @@
+/*
+ * @brief Aggregator mode of the transmission driver
+ */
+
+
+#ifndef _TRANSMISSION_AGGREGATOR_H_
+#define _TRANSMISSION_AGGREGATOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/**
+ * Check all the required application for task aggregator_handler.
+ * These macros are application specific and can be changed and customized.
+*/
+#define aggregator_process_stack_size (4096u)             //bytes in esp 32 and words in freeRTOS
+#define aggregator_process_priority   PROCESS_PRIORITY   //(0 to configMAX_PRIORITIES - 1)
+#define aggregator_process_CPU        (1)               //In the case of more than one cpu
+
+/*
+ * Initializes the aggregator.
+ *
+ * Opens the UDP socket where the peer nodes deliver their batches and starts the
+ * task that merges them into full frames. The frames are forwarded to the server
+ * over one persistent connection when they are full or when AGGREGATOR_MAX_TIME
+ * expires.
+ */
+void aggregator_init(void);
+
+/*
+ * Adds the samples of a batch to the frame being aggregated.
+ *
+ * Used by the aggregator node to merge its own measurements with the ones of
+ * its peers.
+ *
+ * @param data The batch, as built by the transmission handler (see frame.h).
+ * @param data_len The size of the batch in bytes.
+ */
+void aggregator_submit(const uint8_t *data, size_t data_len);
+
+
+#endif
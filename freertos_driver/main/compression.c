@@ -0,0 +1,102 @@
+/*
+ * Swinging-door compression of the sensor data.
+ *
+ * Instead of the step function of the dead-band filter, the stream is
+ * approximated by a piecewise-linear function. Each segment starts at an
+ * anchor, and two "doors" pivot around anchor +/- deviation, narrowing at
+ * each new sample. When a sample does not fit between the doors, the segment
+ * ends at the previous sample and only that endpoint is transmitted. Ramping
+ * signals are then represented by a few endpoints.
+ */
+
+#include "compression.h"
+
+/*
+ * Emits the end of the current segment at the pending sample.
+ *
+ * The value is moved onto the segment, within the deviation of the real value,
+ * so the error bound also holds for the samples in between. The endpoint
+ * becomes the anchor of the next segment.
+ */
+static void sdt_emit_pending(struct sdt_state *sdt, struct sensor *emitted){
+
+    float dx = (float)(sdt->pending.sequence - sdt->anchor.sequence);
+    float slope = (sdt->pending.value - sdt->anchor.value) / dx;
+
+    if(slope > sdt->slope_upper){
+        slope = sdt->slope_upper;
+    }else if(slope < sdt->slope_lower){
+        slope = sdt->slope_lower;
+    }
+
+    *emitted = sdt->pending;
+    emitted->value = sdt->anchor.value + slope * dx;
+
+    sdt->anchor = *emitted;
+    sdt->has_pending = false;
+}
+
+
+void sdt_reset(struct sdt_state *sdt){
+    sdt->has_anchor = false;
+    sdt->has_pending = false;
+}
+
+
+bool sdt_process(struct sdt_state *sdt, float deviation, const struct sensor *sample, struct sensor *emitted){
+
+    float dx;
+    float upper;
+    float lower;
+    bool emit = false;
+
+    //the first sample, or a restarted sequence, is emitted as it is
+    if(!sdt->has_anchor || (int32_t)(sample->sequence - sdt->anchor.sequence) <= 0){
+        sdt->anchor = *sample;
+        sdt->has_anchor = true;
+        sdt->has_pending = false;
+        *emitted = *sample;
+        return true;
+    }
+
+    dx = (float)(sample->sequence - sdt->anchor.sequence);
+    upper = (sample->value + deviation - sdt->anchor.value) / dx;
+    lower = (sample->value - deviation - sdt->anchor.value) / dx;
+
+    if(sdt->has_pending){
+        //narrow the doors
+        if(upper > sdt->slope_upper){
+            upper = sdt->slope_upper;
+        }
+        if(lower < sdt->slope_lower){
+            lower = sdt->slope_lower;
+        }
+
+        //the doors crossed: the segment ends at the pending sample
+        if(lower > upper){
+            sdt_emit_pending(sdt, emitted);
+            emit = true;
+
+            dx = (float)(sample->sequence - sdt->anchor.sequence);
+            upper = (sample->value + deviation - sdt->anchor.value) / dx;
+            lower = (sample->value - deviation - sdt->anchor.value) / dx;
+        }
+    }
+
+    sdt->slope_upper = upper;
+    sdt->slope_lower = lower;
+    sdt->pending = *sample;
+    sdt->has_pending = true;
+
+    return emit;
+}
+
+
+bool sdt_close(struct sdt_state *sdt, struct sensor *emitted){
+
+    if(!sdt->has_pending){
+        return false;
+    }
+    sdt_emit_pending(sdt, emitted);
+    return true;
+}
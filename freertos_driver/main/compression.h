@@ -0,0 +1,70 @@
+/*
+ * @brief Swinging-door compression of the sensor data
+ *
+ * Keeps one open segment per stream and emits its endpoints when a sample
+ * falls outside the door. Plain C, shared with compression_bench on the host.
+ */
+
+
+#ifndef _TRANSMISSION_COMPRESSION_H_
+#define _TRANSMISSION_COMPRESSION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "driver.h"
+
+
+/**
+ * @brief State of the swinging-door compression of one stream.
+ *
+ * The x axis of the segments is the sequence number of the samples, so the
+ * server can interpolate the values of the samples that were not sent.
+ */
+struct sdt_state {
+  bool has_anchor;          /**< An anchor point was emitted. */
+  bool has_pending;         /**< A sample is waiting to end the current segment. */
+  struct sensor anchor;     /**< Start of the current segment, as emitted. */
+  struct sensor pending;    /**< Last sample received, candidate end of the segment. */
+  float slope_upper;        /**< Smallest upper slope of the door. */
+  float slope_lower;        /**< Largest lower slope of the door. */
+};
+
+/*
+ * Clears the state, the next sample starts a new segment.
+ *
+ * @param sdt The state to be cleared.
+ */
+void sdt_reset(struct sdt_state *sdt);
+
+/*
+ * Processes one sample of the stream.
+ *
+ * The endpoints are emitted only when a sample can not be represented by the
+ * current segment within the deviation. The value of an emitted endpoint lies
+ * on the segment, so the linear interpolation between two endpoints is within
+ * the deviation of every sample in between.
+ *
+ * @param sdt The state of the stream.
+ * @param deviation The absolute error bound of the reconstruction.
+ * @param sample The new sample.
+ * @param emitted Where the emitted endpoint is stored.
+ *
+ * @return true if an endpoint was emitted.
+ */
+bool sdt_process(struct sdt_state *sdt, float deviation, const struct sensor *sample, struct sensor *emitted);
+
+/*
+ * Ends the current segment at the pending sample.
+ *
+ * Used before a flush, so the server can reconstruct the samples received
+ * so far without waiting for the next endpoint.
+ *
+ * @param sdt The state of the stream.
+ * @param emitted Where the emitted endpoint is stored.
+ *
+ * @return true if an endpoint was emitted.
+ */
+bool sdt_close(struct sdt_state *sdt, struct sensor *emitted);
+
+
+#endif
@@ -8,8 +8,13 @@
  * transmission process. It can be used to transmit data from a variety of
  * sources, including sensors, user input, and file transfers.
  *
+ * Every instance of the driver (struct driver) has its own policy, queue,
+ * buffer, timer and transmission task. The network is reached through the
+ * transport of the instance, so this file does not depend on the wifi module
+ * and can also be compiled on the host (see host/port).
+ *
  * @author Audrei Silva
- * 
+ *
  * @date 2022
  */
 
@@ -18,51 +23,144 @@
 #include "driver.h"
 #include "freertos/timers.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "math.h"
-#include "wifi.h"
-#include "driver/gpio.h"
+#include "nvs.h"
+#include "frame.h"
+#include "compression.h"
 
 /*-----------------------------------------------------------
  *DECLARATIONS PRIVATE
  *----------------------------------------------------------*/
 /**
- * @brief Handler for the timer used to control data transmission.
- *
- * This variable stores a timer handle used to control the timing of data
- * transmission. It is a private variable and should not be accessed or modified
- * outside of this file.
- */
-TimerHandle_t xTimer; 
-
-/**
- * @brief Queue for storing data to be transmitted.
+ * @brief State of one stream of an instance, a (deviceId, measurementType) pair.
  *
- * This variable stores a queue handle used to store data that needs to be
- * transmitted. It is a private variable and should not be accessed or modified
- * outside of this file.
+ * The server rebuilds every stream on its own, so the sequence numbers, the
+ * reference of the dead band and the swinging-door segment are per stream.
  */
-static QueueHandle_t xQueue;
+struct driver_stream {
+  int deviceId;
+  int measurementType;
+
+  /**
+   * Sequence number of the next sample of the stream.
+   *
+   * Numbers every sample received, sent or not, so the server can place the
+   * samples it receives and interpolate the ones in between.
+   */
+  uint32_t sequence;
+
+  /**
+   * Last value accepted, compared to the current measurement in order to
+   * control the process. It is initialized to inf.
+   */
+  float reference;
+
+  struct sdt_state sdt;  /**< Open swinging-door segment. */
+};
 
 /**
- * @brief Mutex for controlling access to shared resources.
- *
- * This variable stores a semaphore handle used to control access to shared
- * resources, such as the transmission queue. It is a private variable and
- * should not be accessed or modified outside of this file.
+ * @brief State of one instance of the driver.
  */
-static SemaphoreHandle_t xMutex;
-
-/**
- * @brief Handle for the task responsible for data transmission.
- *
- * This variable stores a task handle used to identify the task responsible for
- * transmitting data. It is a private variable and should not be accessed or
- * modified outside of this file.
- */
-static TaskHandle_t task_handle;
+struct driver {
+  struct driver_config config;  /**< Configuration given to driver_create(). */
+
+  /**
+   * @brief Handler for the timer used to control data transmission.
+   *
+   * The timer id is the instance, so the callback knows which task to wake.
+   */
+  TimerHandle_t xTimer;
+
+  /**
+   * @brief Queue for storing data to be transmitted.
+   */
+  QueueHandle_t xQueue;
+
+  /**
+   * @brief Mutex for controlling access to shared resources.
+   *
+   * Protects the queue, the filter and the swinging-door state of the instance.
+   */
+  SemaphoreHandle_t xMutex;
+
+  /**
+   * @brief Handle for the task responsible for data transmission.
+   */
+  TaskHandle_t task_handle;
+
+  /**
+   * @brief Given by the transmission task once the last samples are sent in driver_destroy().
+   */
+  SemaphoreHandle_t stopped;
+
+  /**
+   * @brief Spinlock protecting the policy.
+   *
+   * The policy is read by the sensor task and the transmission task and can be
+   * replaced at any time by driver_policy_set().
+   */
+  portMUX_TYPE policy_mux;
+
+  /**
+   * Policy currently in use by the instance.
+   *
+   * Loaded from NVS in driver_create() and replaced by driver_policy_set(). It
+   * must be accessed through driver_policy_get(), under policy_mux.
+   */
+  struct driver_policy policy;
+
+  /**
+   * Set while the server may not know the policy of the instance, after boot,
+   * after a change or on its request, so the next batch carries the whole
+   * policy and not only its hash. Under policy_mux.
+   */
+  bool policy_report;
+
+  /**
+   * Streams submitted to the instance, in order of first arrival, protected by xMutex.
+   */
+  struct driver_stream streams[DRIVER_MAX_STREAMS];
+  size_t n_streams;
+
+  /**
+   * Compression mode of the samples in the queue.
+   *
+   * Follows the policy. Every queued sample carries the mode it was processed
+   * with, and a batch ends where the mode changes, so each batch has a single mode.
+   */
+  uint8_t active_mode;
+
+  /**
+   * Set by the timer, so the transmission handler ends the open swinging-door
+   * segments and the server does not wait for them longer than the policy max time.
+   * Under policy_mux.
+   */
+  bool timer_expired;
+
+  /**
+   * Set by driver_destroy(), so the transmission handler sends the last samples and stops.
+   * Under policy_mux.
+   */
+  bool stopping;
+
+  /**
+   * Period of the timer in ms while the frames are not acknowledged, 0 otherwise.
+   *
+   * It doubles from MIN_TIME up to the policy max time on every failed flush,
+   * and the full queue does not wake the transmission task meanwhile, so an
+   * unreachable server is not retried for every sample. Under policy_mux, as
+   * the period of the timer follows it or the policy.
+   */
+  uint32_t backoff_ms;
+
+  uint8_t *transmission_buffer;  /**< config.buffer_size bytes. */
+};
 
 /*-----------------------------------------------------------
  * FUNCTION PROTOTYPE
@@ -70,8 +168,8 @@ static TaskHandle_t task_handle;
 /**
  * @brief Callback function for timer events.
  *
- * This function is called when the timer specified by the TimerHandle_t 
- * parameter expires. The function performs the transmission with the data in qeue 
+ * This function is called when the timer specified by the TimerHandle_t
+ * parameter expires. The function performs the transmission with the data in qeue
  * in response to the timer event.
  *
  * @param pxTimer The timer handle associated with the timer event.
@@ -81,229 +179,820 @@ void callBackTimer(TimerHandle_t pxTimer);
 /**
  * @brief Handler function to suspend data transmission.
  *
- * This function is called to suspend data transmission, typically in 
- * response to some event or condition. 
+ * Blocks the calling transmission task until it is resumed. A resume
+ * that arrives while the task is sending is not lost, the task runs again.
  */
 static void suspend_transmission_handler(void);
 
 /**
  * @brief Handler function to resume data transmission.
  *
- * This function is called to resume data transmission after it has been 
- * suspended, typically in response to some event or condition. The function 
+ * This function is called to resume data transmission after it has been
+ * suspended, typically in response to some event or condition. The function
  * performs any necessary actions to restart data transmission.
+ *
+ * @param driver The instance.
+ */
+static void resume_transmission_handler(struct driver *driver);
+
+/**
+ * @brief Sends the queued samples of an instance in as many frames as needed.
+ *
+ * @param driver The instance.
+ * @param batch The header of the batches, keeps the round trip time between flushes.
+ *
+ * @return false if a frame was not acknowledged, its samples are back in the queue.
  */
-static void resume_transmission_handler(void);
+static bool transmission_flush(struct driver *driver, struct frame_batch *batch);
 
+/**
+ * @brief Sets the period of the timer after a flush, backing off while the frames are not acknowledged.
+ *
+ * @param driver The instance.
+ * @param acked The result of the flush.
+ */
+static void transmission_backoff(struct driver *driver, bool acked);
+
+/**
+ * @brief Sets the period of the timer to the backoff, or to the max time of the policy.
+ *
+ * The period is read under policy_mux and applied again if it changed
+ * meanwhile, so the last change of the backoff or of the policy wins.
+ *
+ * @param driver The instance.
+ */
+static void driver_timer_apply(struct driver *driver);
+
+/**
+ * @brief Puts the samples of a frame that was not acknowledged back in the queue.
+ *
+ * The samples go to the front of the queue, in their order, so they are sent
+ * again before the newer ones on the next flush. If the queue filled up in the
+ * meantime, the oldest samples are dropped.
+ *
+ * @param driver The instance.
+ * @param batch The header of the frame in the transmission buffer.
+ */
+static void transmission_requeue(struct driver *driver, const struct frame_batch *batch);
+
+/**
+ * @brief Checks if a policy can be applied.
+ *
+ * @param policy The policy to be checked.
+ * @param buffer_size The size of the transmission buffer of the instance.
+ *
+ * @return true if all the fields are within the limits of the instance.
+ */
+static bool policy_is_valid(const struct driver_policy *policy, uint16_t buffer_size);
+
+/**
+ * @brief Loads the policy stored in NVS.
+ *
+ * Falls back to the policy of the configuration when there is no valid policy
+ * stored. NVS must be initialized before, which is done in initialise_wifi().
+ *
+ * @param driver The instance, the key is the name of its configuration.
+ */
+static void policy_load(struct driver *driver);
+
+/**
+ * @brief Stores the policy in NVS.
+ *
+ * @param driver The instance, the key is the name of its configuration.
+ * @param policy The policy to be stored.
+ */
+static void policy_store(const struct driver *driver, const struct driver_policy *policy);
+
+/**
+ * @brief Finds the stream of a sample, or adds it.
+ *
+ * Must be called with xMutex taken.
+ *
+ * @param driver The instance.
+ * @param my_sensor The sample.
+ *
+ * @return The stream, NULL if the instance already has DRIVER_MAX_STREAMS streams.
+ */
+static struct driver_stream *driver_stream_of(struct driver *driver, const struct sensor *my_sensor);
 
-/*-----------------------------------------------------------
- * GLOBAL VARIABLES
- *----------------------------------------------------------*/
 /**
- * Stores the previous measurement for comparison.
+ * @brief Ends the open swinging-door segment of every stream and queues its endpoint, as far as the queue has room.
+ *
+ * Must be called with xMutex taken.
  *
- * This static variable is used to track the previous measurement and compare it
- * to the current measurement in order to control the process. It is initialized
- * to inf by default in drive init.
+ * @param driver The instance.
  */
-static float reference;
+static void driver_streams_close(struct driver *driver);
+
+/**
+ * @brief Swinging-door compression of one sample.
+ *
+ * Queues the segment endpoints emitted by the sample. Must be called with
+ * xMutex taken.
+ *
+ * @param driver The instance.
+ * @param stream The stream of the sample.
+ * @param my_sensor The sample, with its sequence number.
+ * @param current The policy in use.
+ *
+ * @return CRITICAL_THRESHOLD_RESULT if the sample is an abrupt change from the
+ * previous one, 0 otherwise.
+ */
+static uint8_t swinging_door_process(struct driver *driver, struct driver_stream *stream, const struct sensor *my_sensor,
+                                     const struct driver_policy *current);
+
+/**
+ * @brief Releases the resources of an instance.
+ *
+ * Pended to the timer task by driver_destroy(), so it runs after the timer is
+ * deleted and no callback can use the instance anymore.
+ *
+ * @param pvParameter1 The instance.
+ * @param ulParameter2 Not used.
+ */
+static void driver_free(void *pvParameter1, uint32_t ulParameter2);
+
 
 /*
  * This function is called when the data is ready to be transmitted.
  * It retrieves the data from a buffer and sends it over a network
  * connection using a specific protocol.
  *
- * @param pvParameter A pointer to the parameter passed to the function.
- * This is not used in this function.
+ * @param pvParameter The instance of the driver.
  */
 
 void transmission_handler(void *pvParameter)
 {
-    static struct sensor sensor_data_transmission;
-    static uint8_t transmission_buffer[TRANSMISSION_BUFFER_SIZE];
-    int buffer_index = 0;
-        
+    struct driver *driver = pvParameter;
+    struct frame_batch batch = { .flags = FRAME_FLAGS, .last_rtt = 0 };
+    bool stopping;
+    bool timer_expired;
+    bool acked;
+    uint32_t wait_ms;
+
     while(true){
-    
-            printf("Processo em execução\n");
-            //initiate the transmission Loop
 
-            //check if the qeue is empty in the case of error
-            if(uxQueueMessagesWaiting(xQueue) == 0){
-                //transmite a error message 
-                /*
-                    O que fazer aqui?????
-                */
-                
+            //wait until a new event are trigger
+            suspend_transmission_handler();
+            //a stop requested during this flush is handled by the next wake up
+            taskENTER_CRITICAL(&driver->policy_mux);
+            stopping = driver->stopping;
+            timer_expired = driver->timer_expired;
+            driver->timer_expired = false;
+            taskEXIT_CRITICAL(&driver->policy_mux);
+
 #ifdef DEBUG_MODE
-                ESP_LOGI("Tx","Error message");
-#else
-                while(true){};
+            ESP_LOGI("Tx","Processo em execução: %s", driver->config.name);
 #endif
+            //initiate the transmission Loop
+
+            xSemaphoreTake(driver->xMutex, portMAX_DELAY);
+            //on timeout, end the current segments so the server can rebuild the samples up to now
+            if(timer_expired || stopping){
+                driver_streams_close(driver);
             }
-            //initialize tcp client
-            tcp_client();
-            // Loop to transmitting the data
-            while(uxQueueMessagesWaiting(xQueue) != 0){
-                //Take a semaphoro
-                xSemaphoreTake(xMutex, portMAX_DELAY);
-                if (xQueueReceive(xQueue, &sensor_data_transmission, portMAX_DELAY) == pdPASS) {
-                    //After removing an element from the queue, you can now release it to add one more.
-                    xSemaphoreGive(xMutex);
-                    // Copy the element to the transmission buffer
-                    // Fazer a copia do qeue receive direto para o bufer.
-                    memcpy(&transmission_buffer[buffer_index], &sensor_data_transmission, sizeof(struct sensor));
-                    buffer_index += sizeof(struct sensor);
+            xSemaphoreGive(driver->xMutex);
 
-#ifdef DEBUG_MODE
-                    //ESP_LOGI("Tx", "The Temperature is: %0.2f", sensor_data_transmission.value);
-#endif
-                } 
+            //the wake up may come from a flush already done, there is nothing to send then
+            acked = true;
+            if(uxQueueMessagesWaiting(driver->xQueue) != 0){
+                acked = transmission_flush(driver, &batch);
+                transmission_backoff(driver, acked);
+            }
+
+            if(stopping){
+                //the samples that were not acked get a few more attempts before they are dropped,
+                //and the segments left open by a full queue are closed as it empties
+                wait_ms = MIN_TIME;
+                for(int retry = 0; retry < DRIVER_STOP_RETRIES; retry++){
+                    xSemaphoreTake(driver->xMutex, portMAX_DELAY);
+                    driver_streams_close(driver);
+                    xSemaphoreGive(driver->xMutex);
+                    if(uxQueueMessagesWaiting(driver->xQueue) == 0){
+                        break;
+                    }
+                    //the attempts are spread, so a short outage of the server or of the network does not drop the samples
+                    if(!acked){
+                        vTaskDelay(pdMS_TO_TICKS(wait_ms));
+                        wait_ms *= 2;
+                    }
+                    acked = transmission_flush(driver, &batch);
+                }
+                //driver_destroy() deletes the task, wait for it
+                xSemaphoreGive(driver->stopped);
+                while(true){
+                    suspend_transmission_handler();
+                }
             }
-            //Transmission
-            send_data_buffer(transmission_buffer,buffer_index);
 
-            //reset buffer index
-            buffer_index = 0;
             // Reset timmer"
-            xTimerReset(xTimer, 0);
+            xTimerReset(driver->xTimer, 0);
+    }
+}
 
-            // Reset the queue
-            xQueueReset(xQueue);
 
-            //suspend transmission handler until a new event are trigger
-            suspend_transmission_handler();
-            
-                 
+static bool transmission_flush(struct driver *driver, struct frame_batch *batch){
+
+    struct sensor sensor_data_transmission;
+    struct driver_policy flush_policy;
+    int buffer_index;
+    int ack_len;
+    uint8_t mask;
+    bool report = false;
+    int64_t echoed_send_time;
+    int64_t rtt;
+    uint32_t hold;
+    uint8_t ack_buffer[FRAME_POLICY_SIZE];
+
+    driver_policy_get(driver, &flush_policy);
+
+    // Send as many frames as needed to empty the queue
+    do{
+        //the server computes its policy delta against the policy reported by the instance
+        batch->flags = FRAME_FLAGS;
+        if(driver->config.remote_policy){
+            taskENTER_CRITICAL(&driver->policy_mux);
+            report = driver->policy_report;
+            driver->policy_report = false;
+            taskEXIT_CRITICAL(&driver->policy_mux);
+            batch->flags |= FRAME_FLAG_POLICY | (report ? FRAME_FLAG_POLICY_REPORT : 0);
+            batch->policy = flush_policy;
+        }
+        buffer_index = FRAME_BATCH_HEADER_SIZE(batch->flags);
+        batch->count = 0;
+        // Loop to transmitting the data, up to the frame size of the policy
+        while(uxQueueMessagesWaiting(driver->xQueue) != 0 &&
+              buffer_index + FRAME_BATCH_RECORD_SIZE(batch->flags) <= flush_policy.transmission_buffer_size){
+            //Take a semaphoro
+            xSemaphoreTake(driver->xMutex, portMAX_DELAY);
+            //a batch has a single mode and 32-bit time deltas, the samples that do not fit go in the next batch;
+            //requeued samples can be older than the timer allows
+            if(xQueuePeek(driver->xQueue, &sensor_data_transmission, 0) != pdPASS ||
+               (batch->count > 0 && (sensor_data_transmission.mode != batch->mode ||
+                                     sensor_data_transmission.timestamp < batch->base_time ||
+                                     sensor_data_transmission.timestamp - batch->base_time > UINT32_MAX))){
+                xSemaphoreGive(driver->xMutex);
+                break;
+            }
+            xQueueReceive(driver->xQueue, &sensor_data_transmission, 0);
+            //After removing an element from the queue, you can now release it to add one more.
+            xSemaphoreGive(driver->xMutex);
+            //the timestamps are sent as deltas from the first sample of the batch
+            if(batch->count == 0){
+                batch->mode = sensor_data_transmission.mode;
+                batch->base_time = sensor_data_transmission.timestamp;
+            }
+            // Copy the element to the transmission buffer
+            buffer_index += frame_batch_record(&driver->transmission_buffer[buffer_index], batch, &sensor_data_transmission);
+            batch->count++;
+        }
+        batch->send_time = esp_timer_get_time();
+        frame_batch_header(driver->transmission_buffer, batch);
+
+        //Transmission
+        ack_len = driver->config.transport(driver->config.transport_ctx, driver->transmission_buffer,
+                                           buffer_index, ack_buffer, sizeof(ack_buffer));
+        //the server only acks a batch once it is durable, until then the samples are kept
+        if(ack_len < 0){
+            transmission_requeue(driver, batch);
+            taskENTER_CRITICAL(&driver->policy_mux);
+            driver->policy_report |= report;
+            taskEXIT_CRITICAL(&driver->policy_mux);
+            return false;
+        }
+        //the echo of the send time gives the round trip time, sent with the next batch
+        //so the server can estimate the latency and correct the drift of the clock;
+        //the time the server held the ack until the batch was durable is not latency
+        if(ack_len > 0 && frame_decode_ack_time(ack_buffer, ack_len, &echoed_send_time, &hold) &&
+           echoed_send_time == batch->send_time){
+            rtt = esp_timer_get_time() - echoed_send_time;
+            batch->last_rtt = rtt > (int64_t)hold ? (uint32_t)(rtt - hold) : 0;
+        }
+        //the server may piggyback a policy delta on the ack
+        mask = 0;
+        if(ack_len > 0 && driver->config.remote_policy){
+            mask = frame_decode_policy(ack_buffer, ack_len, &flush_policy);
+        }
+        if(mask & POLICY_REPORT_REQUEST){
+            taskENTER_CRITICAL(&driver->policy_mux);
+            driver->policy_report = true;
+            taskEXIT_CRITICAL(&driver->policy_mux);
+        }
+        if(mask & ~POLICY_REPORT_REQUEST){
+            driver_policy_set(driver, &flush_policy);
+        }
+        driver_policy_get(driver, &flush_policy);
+    }while(uxQueueMessagesWaiting(driver->xQueue) != 0);
+
+    return true;
+}
+
+
+static void transmission_backoff(struct driver *driver, bool acked){
+
+    uint32_t backoff_ms;
+    bool changed;
+
+    taskENTER_CRITICAL(&driver->policy_mux);
+    backoff_ms = driver->backoff_ms;
+    if(acked){
+        //back to the period of the policy
+        driver->backoff_ms = 0;
+    }else if(driver->backoff_ms == 0){
+        driver->backoff_ms = MIN_TIME;
+    }else if(driver->backoff_ms < driver->policy.max_time / 2){
+        driver->backoff_ms *= 2;
+    }else{
+        driver->backoff_ms = driver->policy.max_time;
     }
+    changed = driver->backoff_ms != backoff_ms;
+    backoff_ms = driver->backoff_ms;
+    taskEXIT_CRITICAL(&driver->policy_mux);
+
+    if(changed){
+        driver_timer_apply(driver);
+    }
+
+#ifdef DEBUG_MODE
+    if(!acked){
+        ESP_LOGI("Tx","%s: no ack, next attempt in %u ms", driver->config.name, (unsigned)backoff_ms);
+    }
+#endif
+}
+
+
+static void driver_timer_apply(struct driver *driver){
+
+    uint32_t applied = 0;
+    uint32_t period;
+
+    while(true){
+        taskENTER_CRITICAL(&driver->policy_mux);
+        period = driver->backoff_ms != 0 ? driver->backoff_ms : driver->policy.max_time;
+        taskEXIT_CRITICAL(&driver->policy_mux);
+        if(period == applied){
+            return;
+        }
+        xTimerChangePeriod(driver->xTimer, pdMS_TO_TICKS(period), 0);
+        applied = period;
+    }
+}
+
+
+static void transmission_requeue(struct driver *driver, const struct frame_batch *batch){
+
+    struct sensor sample;
+    uint16_t dropped = 0;
+
+    xSemaphoreTake(driver->xMutex, portMAX_DELAY);
+    for(int i = batch->count - 1; i >= 0; i--){
+        frame_batch_decode_record(&driver->transmission_buffer[FRAME_BATCH_HEADER_SIZE(batch->flags) +
+                                                               i * FRAME_BATCH_RECORD_SIZE(batch->flags)],
+                                  batch, &sample);
+        if(xQueueSendToFront(driver->xQueue, &sample, 0) != pdPASS){
+            dropped++;
+        }
+    }
+    xSemaphoreGive(driver->xMutex);
+
+#ifdef DEBUG_MODE
+    ESP_LOGI("Tx","%s: no ack, %u samples kept, %u dropped", driver->config.name,
+             (unsigned)(batch->count - dropped), (unsigned)dropped);
+#else
+    (void)dropped;
+#endif
 }
 
 
 static void suspend_transmission_handler(void){
-    vTaskSuspend(task_handle);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+static void resume_transmission_handler(struct driver *driver){
+    xTaskNotifyGive(driver->task_handle);
 }
 
-static void resume_transmission_handler(void){
-    vTaskResume(task_handle);
+
+static bool policy_is_valid(const struct driver_policy *policy, uint16_t buffer_size){
+
+    return policy->transmission_buffer_size >= FRAME_BATCH_HEADER_SIZE(FRAME_FLAGS) + FRAME_BATCH_RECORD_SIZE(FRAME_FLAGS)
+        && policy->transmission_buffer_size <= buffer_size
+        && policy->max_length >= 1
+        && policy->max_length <= MAX_LENGHT_LIMIT_OF(policy->transmission_buffer_size)
+        && policy->max_time >= MIN_TIME
+        && policy->max_time <= MAX_TIME_LIMIT
+        && policy->tolerance_percentage <= policy->tolerance_percentage_critical
+        && policy->tolerance_percentage_critical <= 100
+        && (policy->compression_mode == COMPRESSION_DEADBAND || policy->compression_mode == COMPRESSION_SWINGING_DOOR)
+        && policy->sdt_deviation > 0;
 }
 
 
-void driver_init(){
+static void policy_load(struct driver *driver){
+
+    struct driver_policy stored;
+    size_t len = sizeof(stored);
+    nvs_handle_t handle;
+
+    driver->policy = driver->config.policy;
 
+    if(nvs_open(POLICY_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK){
+        return;
+    }
+    if(nvs_get_blob(handle, driver->config.name, &stored, &len) == ESP_OK &&
+       len == sizeof(stored) && policy_is_valid(&stored, driver->config.buffer_size)){
+        driver->policy = stored;
 #ifdef DEBUG_MODE
-    printf("Driver init..\n");
+        ESP_LOGI("Policy","%s loaded from NVS", driver->config.name);
 #endif
-    
-    //Creating a periodic timer and auto-reaload
-    xTimer = xTimerCreate(  "Timer",                    //Name of the timer
-                            pdMS_TO_TICKS(MAX_TIME),    //period of the time
-                            false,                      //one - shoot
-                            0,                          // Timer ID
-                            callBackTimer);             // Callback function
-    //check the sucessfull creation of the timer
-    if(xTimer == NULL)
-    {
+    }
+    nvs_close(handle);
+}
+
+
+static void policy_store(const struct driver *driver, const struct driver_policy *policy){
+
+    nvs_handle_t handle;
+
+    if(nvs_open(POLICY_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK){
 #ifdef DEBUG_MODE
-        ESP_LOGI("xTimer","error to create a timer");
+        ESP_LOGI("Policy","error to open NVS");
 #endif
-        while(1);
-    }else{
-        xTimerStart(xTimer,0);
+        return;
+    }
+    if(nvs_set_blob(handle, driver->config.name, policy, sizeof(*policy)) != ESP_OK ||
+       nvs_commit(handle) != ESP_OK){
+#ifdef DEBUG_MODE
+        ESP_LOGI("Policy","error to store in NVS");
+#endif
+    }
+    nvs_close(handle);
+}
+
+
+void driver_policy_get(driver_handle_t driver, struct driver_policy *current){
+
+    taskENTER_CRITICAL(&driver->policy_mux);
+    *current = driver->policy;
+    taskEXIT_CRITICAL(&driver->policy_mux);
+}
+
+
+bool driver_policy_set(driver_handle_t driver, const struct driver_policy *new_policy){
+
+    struct driver_policy previous;
+    bool period_changed;
+
+    if(!policy_is_valid(new_policy, driver->config.buffer_size)){
+#ifdef DEBUG_MODE
+        ESP_LOGI("Policy","invalid policy, keeping the current one");
+#endif
+        return false;
+    }
+
+    taskENTER_CRITICAL(&driver->policy_mux);
+    previous = driver->policy;
+    driver->policy = *new_policy;
+    //during a backoff the period follows the backoff, the new one is applied once the frames are acknowledged
+    period_changed = previous.max_time != new_policy->max_time && driver->backoff_ms == 0;
+    taskEXIT_CRITICAL(&driver->policy_mux);
+
+    //a delta the instance already runs does not wear the flash
+    if(frame_policy_hash(&previous) == frame_policy_hash(new_policy)){
+        return true;
+    }
+    //the server learns the new policy with the next batch
+    taskENTER_CRITICAL(&driver->policy_mux);
+    driver->policy_report = true;
+    taskEXIT_CRITICAL(&driver->policy_mux);
+
+    //the new period is applied from now on
+    if(period_changed){
+        driver_timer_apply(driver);
+    }
+
+    policy_store(driver, new_policy);
+
+#ifdef DEBUG_MODE
+    ESP_LOGI("Policy","%s: max_length %u, max_time %u ms, buffer %u bytes, tolerance %u%%/%u%%, mode %u, deviation %0.3f",
+             driver->config.name, new_policy->max_length, (unsigned)new_policy->max_time,
+             new_policy->transmission_buffer_size, new_policy->tolerance_percentage,
+             new_policy->tolerance_percentage_critical, new_policy->compression_mode, new_policy->sdt_deviation);
+#endif
+
+    return true;
+}
+
+
+void driver_config_default(struct driver_config *config){
+
+    memset(config, 0, sizeof(*config));
+    config->name = POLICY_NVS_KEY;
+    config->policy.max_length = MAX_LENGHT;
+    config->policy.transmission_buffer_size = TRANSMISSION_BUFFER_SIZE;
+    config->policy.max_time = MAX_TIME;
+    config->policy.tolerance_percentage = MEASURE_TOLERANCE_PERCENTAGE;
+    config->policy.tolerance_percentage_critical = MEASURE_TOLERANCE_PERCENTAGE_CRITICAL;
+    config->policy.compression_mode = COMPRESSION_MODE;
+    config->policy.sdt_deviation = SDT_DEVIATION;
+    config->buffer_size = TRANSMISSION_BUFFER_SIZE;
+    config->remote_policy = false;
+    config->stack_size = transmission_Process_stack_size;
+    config->priority = transmission_process_priority;
+    config->cpu = transmission_process_CPU;
+}
+
+
+driver_handle_t driver_create(const struct driver_config *config){
+
+    struct driver *driver;
+
+#ifdef DEBUG_MODE
+    printf("Driver init %s..\n", config->name);
+#endif
+
+    if(config->transport == NULL || config->name == NULL ||
+       config->buffer_size < FRAME_BATCH_HEADER_SIZE(FRAME_FLAGS) + FRAME_BATCH_RECORD_SIZE(FRAME_FLAGS) ||
+       !policy_is_valid(&config->policy, config->buffer_size)){
+#ifdef DEBUG_MODE
+        ESP_LOGI("Driver","invalid configuration");
+#endif
+        return NULL;
     }
 
+    driver = calloc(1, sizeof(*driver));
+    if(driver == NULL){
+        return NULL;
+    }
+    driver->config = *config;
+    portMUX_INITIALIZE(&driver->policy_mux);
+
+    //the policy defines the timer period and the filter
+    policy_load(driver);
+
+    driver->policy_report = true;
+    driver->n_streams = 0;
+    driver->active_mode = driver->policy.compression_mode;
+
+    driver->transmission_buffer = malloc(config->buffer_size);
+
     //creating a queue
-    xQueue = xQueueCreate( MAX_LENGHT, sizeof( struct sensor ));
-    //check the sucessfull creation of the queue
-   if(xQueue == NULL){
+    //sized for the largest policy, the flush threshold is policy.max_length
+    driver->xQueue = xQueueCreate(MAX_LENGHT_LIMIT_OF(config->buffer_size), sizeof( struct sensor ));
+
+    //creating a mutex
+    driver->xMutex = xSemaphoreCreateMutex();
+    driver->stopped = xSemaphoreCreateBinary();
+
+    //Creating a one-shot timer, reset after each flush
+    driver->xTimer = xTimerCreate(  "Timer",                    //Name of the timer
+                            pdMS_TO_TICKS(driver->policy.max_time), //period of the time
+                            false,                      //one - shoot
+                            driver,                     // Timer ID
+                            callBackTimer);             // Callback function
+
+    //check the sucessfull creation of the resources
+    if(driver->transmission_buffer == NULL || driver->xQueue == NULL || driver->xMutex == NULL ||
+       driver->stopped == NULL || driver->xTimer == NULL){
 #ifdef DEBUG_MODE
-        ESP_LOGI("xTimer","erro to creat a queue");
+        ESP_LOGI("Driver","error to create the resources of %s", config->name);
 #endif
-        while(1);
-    } 
+        if(driver->xTimer != NULL){
+            xTimerDelete(driver->xTimer, portMAX_DELAY);
+        }
+        driver_free(driver, 0);
+        return NULL;
+    }
 
-    //Transmitting process initialization
-    xTaskCreatePinnedToCore(                        // Use xTaskCreate() in vanilla FreeRTOS
-              transmission_handler,                 // Function pointer to be called
-              "Task transmission_handler",          // Name of task
-              transmission_Process_stack_size,      // Stack size (bytes in ESP32, words in FreeRTOS)
-              NULL,                                 // Parameter to pass to function
-              transmission_process_priority,        // Task priority (0 to configMAX_PRIORITIES - 1)
-              &task_handle,                         // Task handle
-              transmission_process_CPU); 
     /*
-        The transmission process are suspend until 
-        until the data is ready to be transmitted
-    */   
-    vTaskSuspend(task_handle);
+        The transmission process waits until
+        the data is ready to be transmitted
+    */
+    if(xTaskCreatePinnedToCore(                     // Use xTaskCreate() in vanilla FreeRTOS
+              transmission_handler,                 // Function pointer to be called
+              config->name,                         // Name of task
+              config->stack_size,                   // Stack size (bytes in ESP32, words in FreeRTOS)
+              driver,                               // Parameter to pass to function
+              config->priority,                     // Task priority (0 to configMAX_PRIORITIES - 1)
+              &driver->task_handle,                 // Task handle
+              config->cpu) != pdPASS){
+#ifdef DEBUG_MODE
+        ESP_LOGI("Driver","error to create the task of %s", config->name);
+#endif
+        driver->task_handle = NULL;
+        xTimerDelete(driver->xTimer, portMAX_DELAY);
+        driver_free(driver, 0);
+        return NULL;
+    }
+
+    xTimerStart(driver->xTimer, 0);
+
+    return driver;
+}
 
-    //creating a mutex
-    xMutex = xSemaphoreCreateMutex(); 
 
-    reference = INFINITY;
+void driver_destroy(driver_handle_t driver){
 
+    //the task sends what is left in the queue before stopping
+    taskENTER_CRITICAL(&driver->policy_mux);
+    driver->stopping = true;
+    taskEXIT_CRITICAL(&driver->policy_mux);
+    resume_transmission_handler(driver);
+    xSemaphoreTake(driver->stopped, portMAX_DELAY);
+
+    //the timer commands are processed in order, so the instance is freed after the timer is gone
+    xTimerDelete(driver->xTimer, portMAX_DELAY);
+    xTimerPendFunctionCall(driver_free, driver, 0, portMAX_DELAY);
 }
 
 
-void process_sensor_data(struct sensor  my_sensor){
-  
+static void driver_free(void *pvParameter1, uint32_t ulParameter2){
+
+    struct driver *driver = pvParameter1;
+    (void)ulParameter2;
+
+    if(driver->task_handle != NULL){
+        vTaskDelete(driver->task_handle);
+    }
+    if(driver->xQueue != NULL){
+        vQueueDelete(driver->xQueue);
+    }
+    if(driver->xMutex != NULL){
+        vSemaphoreDelete(driver->xMutex);
+    }
+    if(driver->stopped != NULL){
+        vSemaphoreDelete(driver->stopped);
+    }
+    free(driver->transmission_buffer);
+    free(driver);
+}
+
+
+static struct driver_stream *driver_stream_of(struct driver *driver, const struct sensor *my_sensor){
+
+    struct driver_stream *stream;
+
+    for(size_t i = 0; i < driver->n_streams; i++){
+        if(driver->streams[i].deviceId == my_sensor->deviceId &&
+           driver->streams[i].measurementType == my_sensor->measurementType){
+            return &driver->streams[i];
+        }
+    }
+    if(driver->n_streams == DRIVER_MAX_STREAMS){
+        return NULL;
+    }
+
+    stream = &driver->streams[driver->n_streams++];
+    stream->deviceId = my_sensor->deviceId;
+    stream->measurementType = my_sensor->measurementType;
+    stream->sequence = 0;
+    stream->reference = INFINITY;
+    sdt_reset(&stream->sdt);
+    return stream;
+}
+
+
+static void driver_streams_close(struct driver *driver){
+
+    struct sensor endpoint;
+
+    if(driver->active_mode != COMPRESSION_SWINGING_DOOR){
+        return;
+    }
+    for(size_t i = 0; i < driver->n_streams; i++){
+        //while the server does not ack the queue can fill up, the segments are then closed by a later flush
+        if(uxQueueSpacesAvailable(driver->xQueue) == 0){
+            break;
+        }
+        if(sdt_close(&driver->streams[i].sdt, &endpoint)){
+            xQueueSend(driver->xQueue, &endpoint, 0);
+        }
+    }
+}
 
-#ifdef MEASURE_THRESHOLD
-        static uint8_t threshold_result;
 
-        threshold_result = OUTSIDE_TOLERANCE(my_sensor.value, reference);
+static uint8_t swinging_door_process(struct driver *driver, struct driver_stream *stream, const struct sensor *my_sensor,
+                                     const struct driver_policy *current){
+
+    struct sensor endpoint;
+    uint8_t threshold_result;
+
+    //in this mode a critical variation is an abrupt change from the previous sample
+    threshold_result = OUTSIDE_TOLERANCE_PCT(my_sensor->value, stream->reference,
+                                             current->tolerance_percentage,
+                                             current->tolerance_percentage_critical);
+    threshold_result = threshold_result == CRITICAL_THRESHOLD_RESULT ? CRITICAL_THRESHOLD_RESULT : 0;
+    stream->reference = my_sensor->value;
+
+    if(sdt_process(&stream->sdt, current->sdt_deviation, my_sensor, &endpoint)){
+        xQueueSend(driver->xQueue, &endpoint, 0);
+    }
+    //a critical variation is sent right away, without waiting for the end of the segment
+    if(threshold_result == CRITICAL_THRESHOLD_RESULT && sdt_close(&stream->sdt, &endpoint)){
+        xQueueSend(driver->xQueue, &endpoint, 0);
+    }
+
+    return threshold_result;
+}
+
+
+void driver_submit(driver_handle_t driver, struct sensor my_sensor){
+
+        uint8_t threshold_result = 0;
+        struct driver_policy current;
+        struct driver_stream *stream;
+        bool backing_off;
+        driver_policy_get(driver, &current);
+        taskENTER_CRITICAL(&driver->policy_mux);
+        backing_off = driver->backoff_ms != 0;
+        taskEXIT_CRITICAL(&driver->policy_mux);
+
+#ifdef ENABLE_TIMESTAMP
+        //stamped when sampled, before the filter, so the endpoints of the segments keep their time
+        my_sensor.timestamp = esp_timer_get_time();
+#else
+        my_sensor.timestamp = 0;
+#endif
+
+        xSemaphoreTake(driver->xMutex, portMAX_DELAY);
+        //the open segments are ended in the old mode, their endpoints keep the mode they were processed with
+        if(driver->active_mode != current.compression_mode){
+            driver_streams_close(driver);
+            driver->active_mode = current.compression_mode;
+            for(size_t i = 0; i < driver->n_streams; i++){
+                driver->streams[i].reference = INFINITY;
+                sdt_reset(&driver->streams[i].sdt);
+            }
+        }
+        stream = driver_stream_of(driver, &my_sensor);
+        if(stream == NULL){
+            xSemaphoreGive(driver->xMutex);
+#ifdef DEBUG_MODE
+            ESP_LOGI("QEUE","%s: more than %d streams, sample dropped", driver->config.name, DRIVER_MAX_STREAMS);
+#endif
+            return;
+        }
+        my_sensor.sequence = stream->sequence++;
+        my_sensor.mode = driver->active_mode;
+        if(driver->active_mode == COMPRESSION_SWINGING_DOOR){
+            threshold_result = swinging_door_process(driver, stream, &my_sensor, &current);
+        }else{
+#ifdef MEASURE_THRESHOLD
+        threshold_result = OUTSIDE_TOLERANCE_PCT(my_sensor.value, stream->reference,
+                                                 current.tolerance_percentage,
+                                                 current.tolerance_percentage_critical);
 
        //check if the threshold tolerance was hit
        if(threshold_result){
-           reference = my_sensor.value;
-#endif
-           
-#ifdef ENABLE_TIMESTAMP
-           my_sensor.timestamp = esp_timer_get_time();
+           stream->reference = my_sensor.value;
 #endif
+
 #ifdef DEBUG_MODE
        ESP_LOGI("QEUE","Put in qeue");
 #endif
-           //Take mutex
-           xSemaphoreTake(xMutex, portMAX_DELAY);
            //Add data in the QEUE
-           xQueueSend(xQueue, &my_sensor, 0);
-           //Give back Mutex
-           xSemaphoreGive(xMutex);
+           xQueueSend(driver->xQueue, &my_sensor, 0);
 
 #ifdef MEASURE_THRESHOLD
        }
 #endif
+        }
+        xSemaphoreGive(driver->xMutex);
 
-   //check if the qeue is full
-  if (uxQueueSpacesAvailable(xQueue) == 0 
+   //check if the qeue is full, while the server does not ack the timer paces the attempts
+  if (!backing_off && (uxQueueMessagesWaiting(driver->xQueue) >= current.max_length
 #ifdef CRITICAL_MEASURE_THRESHOLD
     || threshold_result == CRITICAL_THRESHOLD_RESULT
 #endif
-   ){
-        
+   )){
+
 #ifdef DEBUG_MODE
-       if(threshold_result == CRITICAL_THRESHOLD_RESULT) 
+       if(threshold_result == CRITICAL_THRESHOLD_RESULT)
             ESP_LOGI("QEUE","critical");
        else
             ESP_LOGI("QEUE","The QEUE is full");
 #endif
        //transmite dados
-       resume_transmission_handler();
+       resume_transmission_handler(driver);
    }
-   
-    
+
+
 }
 
 
 
 void callBackTimer(TimerHandle_t pxTimer){
 
+    struct driver *driver = pvTimerGetTimerID(pxTimer);
+
 #ifdef DEBUG_MODE
     ESP_LOGI("xTimer","timer timeout -->enble transmission is true");
-#endif  
+#endif
 
-    resume_transmission_handler();
-        
-}
+    taskENTER_CRITICAL(&driver->policy_mux);
+    driver->timer_expired = true;
+    taskEXIT_CRITICAL(&driver->policy_mux);
 
+    resume_transmission_handler(driver);
 
+}
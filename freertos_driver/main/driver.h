@@ -9,6 +9,9 @@
 #ifndef _TRANSMISSION_DRIVER_H_
 #define _TRANSMISSION_DRIVER_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 /*-----------------------------------------------------------
  * MACROS AND DEFINITIONS
@@ -19,9 +22,16 @@
 #define DEBUG_MODE 1
 /*
 *
-* This macro enables the timestamp feature to be added to log messages
+* This macro enables the timestamp feature: each sample is stamped with esp_timer_get_time()
+* when it is processed, and sent as a delta from the base time of its batch (see frame.h)
+*/
+#define ENABLE_TIMESTAMP 
+
+/*
+* MAX_LENGHT, MAX_TIME, TRANSMISSION_BUFFER_SIZE and the tolerance percentages are
+* the default values of the driver policy (struct driver_policy). The policy stored
+* in NVS, or pushed by the server in the ack of a flush, overrides them at runtime.
 */
-//#define ENABLE_TIMESTAMP 
 
 /* Queue definitions */  
 #define MAX_LENGHT 5 //queue max leght
@@ -29,13 +39,21 @@
 /* Timmer definitions */
 #define TIMER_TICK 1    //tick of the timer
 #define MAX_TIME  30000 // timer timeout in miliseconds
+#define MIN_TIME  1000  // smallest timer timeout accepted from a policy update
+#define MAX_TIME_LIMIT 3600000  // largest timer timeout accepted; a batch also ends where its time deltas leave 32 bits
 
 
 /*
 * Colocar comprimento da fila de acordo com payload size e packet size.
+* This is also the size of the static buffer, so a policy can only lower it.
 */
 #define TRANSMISSION_BUFFER_SIZE 1500  // Define transmission buffer size here
 
+/* Capacity of the queue: a policy can not queue more than one buffer of samples (see frame.h).
+ * Counted with the policy hash; a batch with the whole policy report may need a second frame. */
+#define MAX_LENGHT_LIMIT_OF(buffer_size) (((buffer_size) - FRAME_BATCH_HEADER_SIZE(FRAME_FLAGS | FRAME_FLAG_POLICY)) / FRAME_BATCH_RECORD_SIZE(FRAME_FLAGS))
+#define MAX_LENGHT_LIMIT MAX_LENGHT_LIMIT_OF(TRANSMISSION_BUFFER_SIZE)
+
 
 /*
 * Just add a element in a qeue if it is out of a measure threshould
@@ -45,6 +63,44 @@
 #define MEASURE_TOLERANCE_PERCENTAGE (5) //percent of variation to acept a data like a new measurement
 #define MEASURE_TOLERANCE_PERCENTAGE_CRITICAL (15) //percent of variation to acept a data like a new measurement
 #define CRITICAL_THRESHOLD_RESULT 2
+
+/*
+* Compression mode of the driver.
+*
+* COMPRESSION_DEADBAND: step function, a sample is sent when it leaves the tolerance of the last one sent.
+* COMPRESSION_SWINGING_DOOR: piecewise-linear approximation, only the endpoints of the segments are sent and
+*                            the server interpolates the samples in between within SDT_DEVIATION.
+*/
+#define COMPRESSION_DEADBAND 0
+#define COMPRESSION_SWINGING_DOOR 1
+#define COMPRESSION_MODE COMPRESSION_DEADBAND
+#define SDT_DEVIATION (0.5f)  // absolute error bound of the swinging-door reconstruction
+
+/*
+* Role of this node in the network.
+*
+* DRIVER_ROLE_STANDALONE: the node opens its own connection to the server on every flush.
+* DRIVER_ROLE_PEER: the node sends its batches to a neighbouring aggregator over UDP.
+* DRIVER_ROLE_AGGREGATOR: the node accepts batches from its peers, merges them with its own
+*                         data into full frames and forwards them over one persistent connection.
+*/
+#define DRIVER_ROLE_STANDALONE 0
+#define DRIVER_ROLE_PEER 1
+#define DRIVER_ROLE_AGGREGATOR 2
+#define DRIVER_ROLE DRIVER_ROLE_STANDALONE
+
+/* Aggregator definitions */
+#define AGGREGATOR_PORT 1011       // UDP port where the aggregator listens for peer batches
+#define AGGREGATOR_MAX_TIME 30000  // max time in miliseconds a partial frame waits in the aggregator
+#define PEER_FRAME_SIZE 1472       // max batch of a peer: UDP payload of a 1500 bytes MTU, so it is not fragmented
+
+/* Policy persistence */
+#define POLICY_NVS_NAMESPACE "driver"
+#define POLICY_NVS_KEY "policy"
+#define POLICY_ACK_TIMEOUT 2000  // time in miliseconds to wait for the ack of the server after a flush
+#define DRIVER_STOP_RETRIES 3    // attempts to send the samples not acked when an instance is destroyed, MIN_TIME apart and doubling
+#define DRIVER_MAX_STREAMS 8     // (deviceId, measurementType) streams of one instance, the samples of more streams are dropped
+
 /*
  * Macro description.
  *
@@ -60,8 +116,14 @@
 */
 
 #define OUTSIDE_TOLERANCE(val, ref) \
-    (((val) >= (ref - (MEASURE_TOLERANCE_PERCENTAGE  * ref / 100)) && (val) <= (ref + (MEASURE_TOLERANCE_PERCENTAGE  * ref / 100))) ? 0 : \
-     ((val) >= (ref - (MEASURE_TOLERANCE_PERCENTAGE_CRITICAL * ref / 100)) && (val) <= (ref + (MEASURE_TOLERANCE_PERCENTAGE_CRITICAL * ref / 100))) ? 1 : 2)
+    OUTSIDE_TOLERANCE_PCT(val, ref, MEASURE_TOLERANCE_PERCENTAGE, MEASURE_TOLERANCE_PERCENTAGE_CRITICAL)
+
+/*
+ * Same as OUTSIDE_TOLERANCE, with the percentages given by the caller, e.g. the ones of the policy.
+*/
+#define OUTSIDE_TOLERANCE_PCT(val, ref, pct, pct_critical) \
+    (((val) >= (ref - ((pct)  * ref / 100)) && (val) <= (ref + ((pct)  * ref / 100))) ? 0 : \
+     ((val) >= (ref - ((pct_critical) * ref / 100)) && (val) <= (ref + ((pct_critical) * ref / 100))) ? 1 : 2)
 
 
 //#define desligaradio()  {}//função para desligar o rádio
@@ -91,22 +153,150 @@
 //  int errorCode;        /**< The sinalization of error in the system. */
 //}Sensor_t;
 
-struct sensor {
+typedef struct sensor {
   int deviceId;         /**< The ID of the device that generated the measurement. */ 
   int measurementType;  /**< The type of measurement that was performed. */
   float value;          /**< The value of the measurement. */
+  uint32_t sequence;    /**< Sample counter of the driver, the x axis of the swinging-door segments. */
+  int64_t timestamp;    /**< Time in microseconds since boot when the measurement was processed. */
+  uint8_t mode;         /**< Compression mode the sample was processed with, set by the driver. */
 }Sensor_t;
 
+/**
+ * @brief Runtime policy of the driver.
+ *
+ * Loaded from NVS in driver_init(), with the macros above as defaults, and
+ * updated by the server in the ack of a flush.
+ */
+struct driver_policy {
+  uint16_t max_length;                    /**< Number of queued samples that triggers a flush. */
+  uint16_t transmission_buffer_size;      /**< Max number of bytes sent per frame. */
+  uint32_t max_time;                      /**< Max time in miliseconds between flushes. */
+  uint8_t tolerance_percentage;           /**< Variation to accept a sample as a new measurement. */
+  uint8_t tolerance_percentage_critical;  /**< Variation that triggers an immediate flush. */
+  uint8_t compression_mode;               /**< COMPRESSION_DEADBAND or COMPRESSION_SWINGING_DOOR. */
+  float sdt_deviation;                    /**< Absolute error bound of the swinging-door mode. */
+};
+
+/**
+ * @brief Handle of one instance of the driver.
+ *
+ * Each instance has its own policy, queue, transmission buffer, timer and
+ * task, so a device can run independent pipelines, e.g. a high-rate stream
+ * with aggressive compression next to a low-rate stream with long batching.
+ */
+typedef struct driver *driver_handle_t;
+
+/*
+ * Sends one frame of an instance.
+ *
+ * Called from the transmission task of the instance.
+ *
+ * @param ctx The transport_ctx of the configuration.
+ * @param frame The batch to be sent (see frame.h).
+ * @param frame_len The size of the batch in bytes.
+ * @param ack Where the ack of the server is stored, FRAME_POLICY_SIZE bytes.
+ * @param ack_len The size of ack.
+ *
+ * @return The number of bytes of the ack, 0 if the transport has no acks, or -1 if
+ * the ack was expected and did not arrive. In this case the samples of the frame
+ * are kept in the queue and sent again on the next flush.
+ */
+typedef int (*driver_transport_t)(void *ctx, uint8_t *frame, size_t frame_len, uint8_t *ack, size_t ack_len);
+
+/**
+ * @brief Configuration of an instance of the driver.
+ *
+ * Filled with the defaults of this file by driver_config_default().
+ */
+struct driver_config {
+  const char *name;               /**< Name of the task and NVS key of the policy, up to 15 characters. */
+  struct driver_policy policy;    /**< Policy used when there is no valid one stored in NVS. */
+  uint16_t buffer_size;           /**< Size of the transmission buffer, the largest transmission_buffer_size of the policy. */
+  bool remote_policy;             /**< Report the policy in the batches and apply the delta of the server acks, false by default. At most one instance per node should; driver_init() sets it for the default instance. */
+  driver_transport_t transport;   /**< Sends the frames of the instance. */
+  void *transport_ctx;            /**< Passed to transport. */
+  uint32_t stack_size;            /**< Stack of the transmission task. */
+  uint8_t priority;               /**< Priority of the transmission task. */
+  uint8_t cpu;                    /**< Core of the transmission task. */
+};
+
+/*
+ * Fills a configuration with the default values of driver.h.
+ *
+ * The transport is left unset and must be provided by the caller.
+ *
+ * @param config The configuration to be filled.
+ */
+void driver_config_default(struct driver_config *config);
+
+/*
+ * Creates an instance of the driver.
+ *
+ * Allocates the queue and the transmission buffer of the instance, loads its
+ * policy from NVS and starts its timer and transmission task.
+ *
+ * @param config The configuration of the instance. It is copied, except name
+ * and transport_ctx, which must outlive the instance.
+ *
+ * @return The handle of the instance, NULL if the configuration is invalid or
+ * the resources could not be allocated.
+ */
+driver_handle_t driver_create(const struct driver_config *config);
+
+/*
+ * Processes one sample on an instance, as process_sensor_data() does.
+ *
+ * @param handle The instance.
+ * @param my_sensor The sensor data to be processed.
+ */
+void driver_submit(driver_handle_t handle, struct sensor my_sensor);
+
+/*
+ * Sends the samples still queued and releases the instance.
+ *
+ * No sample may be submitted to the instance during or after this call.
+ *
+ * @param handle The instance.
+ */
+void driver_destroy(driver_handle_t handle);
+
+/*
+ * Copies the policy an instance is using.
+ *
+ * @param handle The instance.
+ * @param policy Where the policy is copied to.
+ */
+void driver_policy_get(driver_handle_t handle, struct driver_policy *policy);
+
+/*
+ * Replaces the policy of an instance without restarting its task.
+ *
+ * A changed policy is stored in NVS and, with remote_policy, reported to the
+ * server with the next batch.
+ *
+ * @param handle The instance.
+ * @param policy The new policy.
+ *
+ * @return false if the policy is invalid, in which case the current one is kept.
+ */
+bool driver_policy_set(driver_handle_t handle, const struct driver_policy *policy);
+
 /*
  * Initializes the device driver and sets up any required resources.
  *
- * This function should be called once before using the driver. It initializes
- * the device driver and performs any necessary setup, such as configuring
- * hardware or allocating memory. If the initialization fails, an error code
- * is returned.
+ * This function should be called once before using the driver. It creates the
+ * default instance, with the configuration of driver_config_default() and the
+ * transport selected by DRIVER_ROLE, used by process_sensor_data(),
+ * driver_get_policy() and driver_set_policy().
  */
 void driver_init(void);
 
+/*
+ * Returns the instance created by driver_init(), NULL before it.
+ */
+driver_handle_t driver_default(void);
+
 /*
  * Processes the sensor data and adds it to the queue for transmission.
  *
@@ -119,5 +309,24 @@ void driver_init(void);
  */
 void process_sensor_data(struct sensor my_sensor);
 
+/*
+ * Copies the policy currently in use.
+ *
+ * @param policy Where the policy is copied to.
+ */
+void driver_get_policy(struct driver_policy *policy);
+
+/*
+ * Replaces the policy of the driver without restarting its task.
+ *
+ * The new policy is checked, applied to the timer and the filter, and stored in
+ * NVS so it survives a reboot.
+ *
+ * @param policy The new policy.
+ *
+ * @return false if the policy is invalid, in which case the current one is kept.
+ */
+bool driver_set_policy(const struct driver_policy *policy);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+/*
+ * Default instance of the driver.
+ *
+ * Keeps the original single instance API (driver_init(), process_sensor_data(),
+ * driver_get_policy() and driver_set_policy()) on top of the instances of
+ * driver.c, with the transport selected by DRIVER_ROLE.
+ */
+
+#include <stdio.h>
+#include "driver.h"
+#include "esp_log.h"
+#include "wifi.h"
+#if DRIVER_ROLE == DRIVER_ROLE_AGGREGATOR
+#include "aggregator.h"
+#endif
+
+/*-----------------------------------------------------------
+ * FUNCTION PROTOTYPE
+ *----------------------------------------------------------*/
+/**
+ * @brief Sends a frame of the default instance according to DRIVER_ROLE.
+ *
+ * See driver_transport_t.
+ */
+static int transport_role(void *ctx, uint8_t *frame, size_t frame_len, uint8_t *ack, size_t ack_len);
+
+
+/*-----------------------------------------------------------
+ * GLOBAL VARIABLES
+ *----------------------------------------------------------*/
+/**
+ * Instance created by driver_init().
+ */
+static driver_handle_t default_driver;
+
+
+static int transport_role(void *ctx, uint8_t *frame, size_t frame_len, uint8_t *ack, size_t ack_len){
+
+    (void)ctx;
+
+#if DRIVER_ROLE == DRIVER_ROLE_PEER
+    (void)ack;
+    (void)ack_len;
+    send_data_aggregator(frame, frame_len);
+    return 0;
+#elif DRIVER_ROLE == DRIVER_ROLE_AGGREGATOR
+    (void)ack;
+    (void)ack_len;
+    aggregator_submit(frame, frame_len);
+    return 0;
+#else
+    //one connection per flush, opened by the call
+    return send_data_buffer_ack(frame, frame_len, ack, ack_len);
+#endif
+}
+
+
+void driver_init(){
+
+    struct driver_config config;
+
+    driver_config_default(&config);
+    config.transport = transport_role;
+#if DRIVER_ROLE == DRIVER_ROLE_PEER
+    //lwIP drops fragmented datagrams, a batch must fit in one UDP packet
+    config.buffer_size = PEER_FRAME_SIZE;
+    config.policy.transmission_buffer_size = PEER_FRAME_SIZE;
+#elif DRIVER_ROLE == DRIVER_ROLE_STANDALONE
+    //the policies of the server are keyed by node, the default instance is the one of the node
+    config.remote_policy = true;
+#endif
+
+    default_driver = driver_create(&config);
+    //check the sucessfull creation of the driver
+    if(default_driver == NULL){
+#ifdef DEBUG_MODE
+        ESP_LOGI("Driver","error to create the driver");
+#endif
+        while(1);
+    }
+
+#if DRIVER_ROLE == DRIVER_ROLE_AGGREGATOR
+    //receive and forward the batches of the peer nodes
+    aggregator_init();
+#endif
+
+}
+
+
+driver_handle_t driver_default(void){
+    return default_driver;
+}
+
+
+void process_sensor_data(struct sensor my_sensor){
+    driver_submit(default_driver, my_sensor);
+}
+
+
+void driver_get_policy(struct driver_policy *current){
+    driver_policy_get(default_driver, current);
+}
+
+
+bool driver_set_policy(const struct driver_policy *new_policy){
+    return driver_policy_set(default_driver, new_policy);
+}
@@ -0,0 +1,378 @@
+/*
+ * Frame encoding for the data forwarded upstream.
+ *
+ * The aggregator collects the samples of several nodes and merges them into
+ * frames of TRANSMISSION_BUFFER_SIZE bytes. Samples are grouped by device and
+ * measurement type, so the ids of a stream are transmitted only once per frame.
+ *
+ * Timestamps are sent as 32 bits deltas from a base time of the batch, or of
+ * the group in an aggregated frame, instead of 64 bits absolute times.
+ */
+
+#include <string.h>
+#include "frame.h"
+
+
+void frame_policy_encode(uint8_t *buf, const struct driver_policy *policy){
+
+    buf[0] = policy->tolerance_percentage;
+    buf[1] = policy->tolerance_percentage_critical;
+    buf[2] = policy->compression_mode;
+    buf[3] = 0;
+    memcpy(&buf[4], &policy->max_length, sizeof(uint16_t));
+    memcpy(&buf[6], &policy->transmission_buffer_size, sizeof(uint16_t));
+    memcpy(&buf[8], &policy->max_time, sizeof(uint32_t));
+    memcpy(&buf[12], &policy->sdt_deviation, sizeof(float));
+}
+
+
+uint32_t frame_policy_hash(const struct driver_policy *policy){
+
+    uint8_t report[FRAME_POLICY_REPORT_SIZE];
+    uint32_t hash = 2166136261u;
+
+    frame_policy_encode(report, policy);
+    for(size_t i = 0; i < sizeof(report); i++){
+        hash = (hash ^ report[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+void frame_batch_header(uint8_t *buf, const struct frame_batch *batch){
+
+    uint32_t magic = FRAME_BATCH_MAGIC;
+    uint32_t hash;
+    size_t index = 8;
+
+    memcpy(&buf[0], &magic, sizeof(uint32_t));
+    buf[4] = batch->mode;
+    buf[5] = batch->flags;
+    memcpy(&buf[6], &batch->count, sizeof(uint16_t));
+
+    if(batch->flags & FRAME_FLAG_TIMESTAMP){
+        memcpy(&buf[8], &batch->base_time, sizeof(int64_t));
+        memcpy(&buf[16], &batch->send_time, sizeof(int64_t));
+        memcpy(&buf[24], &batch->last_rtt, sizeof(uint32_t));
+        index += FRAME_BATCH_TIME_SIZE(batch->flags);
+    }
+
+    if(batch->flags & FRAME_FLAG_POLICY){
+        hash = frame_policy_hash(&batch->policy);
+        memcpy(&buf[index], &hash, sizeof(uint32_t));
+        index += sizeof(uint32_t);
+        if(batch->flags & FRAME_FLAG_POLICY_REPORT){
+            frame_policy_encode(&buf[index], &batch->policy);
+        }
+    }
+}
+
+
+size_t frame_batch_record(uint8_t *buf, const struct frame_batch *batch, const struct sensor *sample){
+
+    uint32_t delta;
+
+    memcpy(&buf[0], &sample->deviceId, sizeof(int32_t));
+    memcpy(&buf[4], &sample->measurementType, sizeof(int32_t));
+    memcpy(&buf[8], &sample->value, sizeof(float));
+    memcpy(&buf[12], &sample->sequence, sizeof(uint32_t));
+
+    if(batch->flags & FRAME_FLAG_TIMESTAMP){
+        delta = (uint32_t)(sample->timestamp - batch->base_time);
+        memcpy(&buf[16], &delta, sizeof(uint32_t));
+    }
+
+    return FRAME_BATCH_RECORD_SIZE(batch->flags);
+}
+
+
+bool frame_batch_decode_header(const uint8_t *buf, size_t len, struct frame_batch *batch){
+
+    uint32_t magic;
+    size_t index = 8;
+
+    if(len < FRAME_BATCH_HEADER_SIZE(0)){
+        return false;
+    }
+    memcpy(&magic, &buf[0], sizeof(uint32_t));
+    batch->mode = buf[4];
+    batch->flags = buf[5];
+    memcpy(&batch->count, &buf[6], sizeof(uint16_t));
+    if(magic != FRAME_BATCH_MAGIC ||
+       ((batch->flags & FRAME_FLAG_POLICY_REPORT) && !(batch->flags & FRAME_FLAG_POLICY)) ||
+       FRAME_BATCH_HEADER_SIZE(batch->flags) + (size_t)batch->count * FRAME_BATCH_RECORD_SIZE(batch->flags) > len){
+        return false;
+    }
+
+    if(batch->flags & FRAME_FLAG_TIMESTAMP){
+        memcpy(&batch->base_time, &buf[8], sizeof(int64_t));
+        memcpy(&batch->send_time, &buf[16], sizeof(int64_t));
+        memcpy(&batch->last_rtt, &buf[24], sizeof(uint32_t));
+    }else{
+        batch->base_time = 0;
+        batch->send_time = 0;
+        batch->last_rtt = 0;
+    }
+    index += FRAME_BATCH_TIME_SIZE(batch->flags);
+
+    batch->policy_hash = 0;
+    if(batch->flags & FRAME_FLAG_POLICY){
+        memcpy(&batch->policy_hash, &buf[index], sizeof(uint32_t));
+        index += sizeof(uint32_t);
+    }
+    if(batch->flags & FRAME_FLAG_POLICY_REPORT){
+        batch->policy.tolerance_percentage = buf[index];
+        batch->policy.tolerance_percentage_critical = buf[index + 1];
+        batch->policy.compression_mode = buf[index + 2];
+        memcpy(&batch->policy.max_length, &buf[index + 4], sizeof(uint16_t));
+        memcpy(&batch->policy.transmission_buffer_size, &buf[index + 6], sizeof(uint16_t));
+        memcpy(&batch->policy.max_time, &buf[index + 8], sizeof(uint32_t));
+        memcpy(&batch->policy.sdt_deviation, &buf[index + 12], sizeof(float));
+    }
+    return true;
+}
+
+
+void frame_batch_decode_record(const uint8_t *buf, const struct frame_batch *batch, struct sensor *sample){
+
+    //read before the stores to sample, which the compiler must assume may alias the batch
+    const uint8_t flags = batch->flags;
+    const uint8_t mode = batch->mode;
+    const int64_t base_time = batch->base_time;
+    uint32_t delta = 0;
+
+    if(flags & FRAME_FLAG_TIMESTAMP){
+        memcpy(&delta, &buf[16], sizeof(uint32_t));
+    }
+    memcpy(&sample->deviceId, &buf[0], sizeof(int32_t));
+    memcpy(&sample->measurementType, &buf[4], sizeof(int32_t));
+    memcpy(&sample->value, &buf[8], sizeof(float));
+    memcpy(&sample->sequence, &buf[12], sizeof(uint32_t));
+    sample->mode = mode;
+    sample->timestamp = (flags & FRAME_FLAG_TIMESTAMP) ? base_time + delta : 0;
+}
+
+
+void frame_aggregator_init(struct frame_aggregator *agg, uint8_t flags){
+    agg->flags = flags;
+    frame_aggregator_reset(agg);
+}
+
+
+void frame_aggregator_reset(struct frame_aggregator *agg){
+    agg->n_samples = 0;
+    agg->n_streams = 0;
+    agg->frame_size = FRAME_HEADER_SIZE(agg->flags);
+}
+
+
+bool frame_aggregator_add(struct frame_aggregator *agg, const struct sensor *sample, uint8_t mode){
+
+    size_t stream;
+    size_t needed = FRAME_VALUE_SIZE(agg->flags);
+    int32_t delta;
+    int64_t time_delta;
+
+    //look for the stream of the sample
+    for(stream = 0; stream < agg->n_streams; stream++){
+        if(agg->streams[stream].deviceId == sample->deviceId &&
+           agg->streams[stream].measurementType == sample->measurementType &&
+           agg->streams[stream].mode == mode){
+            break;
+        }
+    }
+
+    if(stream == agg->n_streams){
+        //a new stream needs its own group header
+        if(agg->n_streams == FRAME_MAX_STREAMS){
+            return false;
+        }
+        needed += FRAME_GROUP_HEADER_SIZE(agg->flags);
+    }else{
+        //the sequence and the time must fit in the deltas of the group
+        delta = (int32_t)(sample->sequence - agg->streams[stream].first_sequence);
+        if(delta < 0 || delta > UINT16_MAX){
+            return false;
+        }
+        time_delta = sample->timestamp - agg->streams[stream].base_time;
+        if((agg->flags & FRAME_FLAG_TIMESTAMP) && (time_delta < 0 || time_delta > UINT32_MAX)){
+            return false;
+        }
+    }
+
+    if(agg->frame_size + needed > TRANSMISSION_BUFFER_SIZE || agg->n_samples == FRAME_MAX_SAMPLES){
+        return false;
+    }
+
+    if(stream == agg->n_streams){
+        agg->streams[stream].deviceId = sample->deviceId;
+        agg->streams[stream].measurementType = sample->measurementType;
+        agg->streams[stream].mode = mode;
+        agg->streams[stream].count = 0;
+        agg->streams[stream].first_sequence = sample->sequence;
+        agg->streams[stream].base_time = sample->timestamp;
+        agg->n_streams++;
+    }
+
+    agg->streams[stream].count++;
+    agg->stream_of[agg->n_samples] = (uint8_t)stream;
+    agg->samples[agg->n_samples++] = *sample;
+    agg->frame_size += needed;
+
+    return true;
+}
+
+
+bool frame_aggregator_add_batch(struct frame_aggregator *agg, const uint8_t *data, size_t data_len, int64_t now,
+                                frame_forward_t forward, void *ctx){
+
+    struct frame_batch batch;
+    struct sensor sample;
+    int64_t clock_offset = 0;
+    size_t index;
+
+    if(!frame_batch_decode_header(data, data_len, &batch)){
+        return false;
+    }
+    index = FRAME_BATCH_HEADER_SIZE(batch.flags);
+
+    //translate the clock of the node to the clock of the aggregator
+    if(batch.flags & FRAME_FLAG_TIMESTAMP){
+        clock_offset = now - batch.send_time;
+    }
+
+    for(uint16_t i = 0; i < batch.count; i++){
+        frame_batch_decode_record(&data[index], &batch, &sample);
+        index += FRAME_BATCH_RECORD_SIZE(batch.flags);
+        sample.timestamp = (batch.flags & FRAME_FLAG_TIMESTAMP) ? sample.timestamp + clock_offset : now;
+
+        if(agg->n_samples == 0){
+            agg->first_time = now;
+        }
+        //the frame is full, forward it and start a new one
+        if(!frame_aggregator_add(agg, &sample, batch.mode)){
+            forward(agg, ctx);
+            frame_aggregator_reset(agg);
+            agg->first_time = now;
+            frame_aggregator_add(agg, &sample, batch.mode);
+        }
+    }
+    return true;
+}
+
+
+size_t frame_aggregator_encode(struct frame_aggregator *agg, uint8_t *buf, size_t len, int64_t send_time){
+
+    size_t index = FRAME_HEADER_SIZE(agg->flags);
+    uint32_t magic = FRAME_AGGREGATED_MAGIC;
+    uint16_t payload;
+    uint16_t delta;
+    uint32_t time_delta;
+
+    if(agg->n_samples == 0 || len < agg->frame_size){
+        return 0;
+    }
+
+    //one group per stream, with the values in arrival order
+    for(size_t stream = 0; stream < agg->n_streams; stream++){
+        memcpy(&buf[index], &agg->streams[stream].deviceId, sizeof(int32_t));
+        index += sizeof(int32_t);
+        memcpy(&buf[index], &agg->streams[stream].measurementType, sizeof(int32_t));
+        index += sizeof(int32_t);
+        buf[index++] = agg->streams[stream].mode;
+        memcpy(&buf[index], &agg->streams[stream].count, sizeof(uint16_t));
+        index += sizeof(uint16_t);
+        memcpy(&buf[index], &agg->streams[stream].first_sequence, sizeof(uint32_t));
+        index += sizeof(uint32_t);
+        if(agg->flags & FRAME_FLAG_TIMESTAMP){
+            memcpy(&buf[index], &agg->streams[stream].base_time, sizeof(int64_t));
+            index += sizeof(int64_t);
+        }
+
+        for(size_t i = 0; i < agg->n_samples; i++){
+            if(agg->stream_of[i] == stream){
+                delta = (uint16_t)(agg->samples[i].sequence - agg->streams[stream].first_sequence);
+                memcpy(&buf[index], &delta, sizeof(uint16_t));
+                index += sizeof(uint16_t);
+                memcpy(&buf[index], &agg->samples[i].value, sizeof(float));
+                index += sizeof(float);
+                if(agg->flags & FRAME_FLAG_TIMESTAMP){
+                    time_delta = (uint32_t)(agg->samples[i].timestamp - agg->streams[stream].base_time);
+                    memcpy(&buf[index], &time_delta, sizeof(uint32_t));
+                    index += sizeof(uint32_t);
+                }
+            }
+        }
+    }
+
+    payload = (uint16_t)(index - FRAME_HEADER_SIZE(agg->flags));
+    memcpy(&buf[0], &magic, sizeof(uint32_t));
+    memcpy(&buf[4], &payload, sizeof(uint16_t));
+    buf[6] = (uint8_t)agg->n_streams;
+    buf[7] = agg->flags;
+    if(agg->flags & FRAME_FLAG_TIMESTAMP){
+        memcpy(&buf[8], &send_time, sizeof(int64_t));
+    }
+
+    frame_aggregator_reset(agg);
+
+    return index;
+}
+
+
+uint8_t frame_decode_policy(const uint8_t *buf, size_t len, struct driver_policy *policy){
+
+    uint32_t magic;
+    uint8_t mask;
+
+    if(len < FRAME_POLICY_SIZE){
+        return 0;
+    }
+    memcpy(&magic, &buf[0], sizeof(uint32_t));
+    if(magic != FRAME_POLICY_MAGIC){
+        return 0;
+    }
+
+    mask = buf[4];
+    if(mask & POLICY_TOLERANCE_PERCENTAGE){
+        policy->tolerance_percentage = buf[5];
+    }
+    if(mask & POLICY_TOLERANCE_PERCENTAGE_CRITICAL){
+        policy->tolerance_percentage_critical = buf[6];
+    }
+    if(mask & POLICY_COMPRESSION_MODE){
+        policy->compression_mode = buf[7];
+    }
+    if(mask & POLICY_MAX_LENGTH){
+        memcpy(&policy->max_length, &buf[8], sizeof(uint16_t));
+    }
+    if(mask & POLICY_TRANSMISSION_BUFFER_SIZE){
+        memcpy(&policy->transmission_buffer_size, &buf[10], sizeof(uint16_t));
+    }
+    if(mask & POLICY_MAX_TIME){
+        memcpy(&policy->max_time, &buf[12], sizeof(uint32_t));
+    }
+    if(mask & POLICY_SDT_DEVIATION){
+        memcpy(&policy->sdt_deviation, &buf[16], sizeof(float));
+    }
+
+    return mask;
+}
+
+
+bool frame_decode_ack_time(const uint8_t *buf, size_t len, int64_t *send_time, uint32_t *hold){
+
+    uint32_t magic;
+
+    if(len < FRAME_POLICY_SIZE){
+        return false;
+    }
+    memcpy(&magic, &buf[0], sizeof(uint32_t));
+    if(magic != FRAME_POLICY_MAGIC){
+        return false;
+    }
+
+    memcpy(send_time, &buf[20], sizeof(int64_t));
+    memcpy(hold, &buf[28], sizeof(uint32_t));
+    return true;
+}
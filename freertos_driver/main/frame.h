@@ -0,0 +1,303 @@
+/*
+ * @brief Frame encoding for the data forwarded upstream
+ *
+ * This module has no dependency on FreeRTOS or ESP-IDF, so it can also be
+ * compiled on the host for simulations and benchmarks.
+ */
+
+
+#ifndef _TRANSMISSION_FRAME_H_
+#define _TRANSMISSION_FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "driver.h"
+
+
+/*-----------------------------------------------------------
+ * MACROS AND DEFINITIONS
+ *----------------------------------------------------------*/
+/* The frame carries the timestamps of the samples and the time of the sender */
+#define FRAME_FLAG_TIMESTAMP (1 << 0)
+/* The batch carries a hash of the policy of the node */
+#define FRAME_FLAG_POLICY (1 << 1)
+/* The batch also carries the whole policy of the node, only with FRAME_FLAG_POLICY */
+#define FRAME_FLAG_POLICY_REPORT (1 << 2)
+
+#ifdef ENABLE_TIMESTAMP
+#define FRAME_FLAGS FRAME_FLAG_TIMESTAMP
+#else
+#define FRAME_FLAGS 0
+#endif
+
+/*
+* Batch sent by a node on each flush (little endian):
+*
+*   header:  uint32 magic | uint8 compression mode | uint8 flags | uint16 number of samples
+*   time:    int64 base time | int64 send time | uint32 last round trip time
+*   policy:  uint32 hash of the report | [report]
+*   report:  uint8 tolerance_percentage | uint8 tolerance_percentage_critical | uint8 compression_mode |
+*            uint8 0 | uint16 max_length | uint16 transmission_buffer_size | uint32 max_time |
+*            float sdt_deviation
+*   samples: { int32 deviceId | int32 measurementType | float value | uint32 sequence |
+*              uint32 timestamp - base time }[number of samples]
+*
+* The time block and the timestamp of the samples are only present with
+* FRAME_FLAG_TIMESTAMP, the policy block with FRAME_FLAG_POLICY and the report
+* with FRAME_FLAG_POLICY_REPORT. The hash is the FNV-1a of the report, so the
+* server computes its policy delta against the policy the node really runs,
+* and asks for the report when it does not know that hash. Times are in microseconds of the clock of the node:
+* the base time is the timestamp of the first sample, the send time is taken
+* right before the batch is sent, and the round trip time is the one measured
+* with the ack of the previous batch, so the server can correct the drift of
+* the clock of the node.
+*
+* The compression mode tells the server how to rebuild the samples that were
+* not sent: hold the last value (dead-band) or interpolate (swinging door).
+*/
+#define FRAME_BATCH_MAGIC 0x31544142u  // "BAT1"
+#define FRAME_POLICY_REPORT_SIZE (16)
+#define FRAME_BATCH_TIME_SIZE(flags) (((flags) & FRAME_FLAG_TIMESTAMP) ? 20 : 0)
+#define FRAME_BATCH_POLICY_SIZE(flags) ((((flags) & FRAME_FLAG_POLICY) ? 4 : 0) + \
+                                        (((flags) & FRAME_FLAG_POLICY_REPORT) ? FRAME_POLICY_REPORT_SIZE : 0))
+#define FRAME_BATCH_HEADER_SIZE(flags) (8 + FRAME_BATCH_TIME_SIZE(flags) + FRAME_BATCH_POLICY_SIZE(flags))
+#define FRAME_BATCH_RECORD_SIZE(flags) (((flags) & FRAME_FLAG_TIMESTAMP) ? 20 : 16)
+
+/*
+* Aggregated frame layout (little endian):
+*
+*   header: uint32 magic | uint16 payload length | uint8 number of groups | uint8 flags |
+*           [int64 send time]
+*   group:  int32 deviceId | int32 measurementType | uint8 compression mode |
+*           uint16 number of values | uint32 first sequence | [int64 base time]
+*   values: { uint16 sequence - first sequence | float value | [uint32 timestamp - base time] }[number of values]
+*
+* The fields in brackets are only present with FRAME_FLAG_TIMESTAMP. The times
+* of the peers are translated to the clock of the aggregator.
+*
+* Samples of the same device and measurement type share one group header, so
+* the ids are sent once per frame instead of once per sample.
+*/
+#define FRAME_AGGREGATED_MAGIC 0x31474741u  // "AGG1"
+#define FRAME_HEADER_SIZE(flags) (((flags) & FRAME_FLAG_TIMESTAMP) ? 16 : 8)
+#define FRAME_GROUP_HEADER_SIZE(flags) (((flags) & FRAME_FLAG_TIMESTAMP) ? 23 : 15)
+#define FRAME_VALUE_SIZE(flags) (((flags) & FRAME_FLAG_TIMESTAMP) ? 10 : 6)
+
+/* Max number of samples that fit in one frame of TRANSMISSION_BUFFER_SIZE */
+#define FRAME_MAX_SAMPLES ((TRANSMISSION_BUFFER_SIZE - FRAME_HEADER_SIZE(0) - FRAME_GROUP_HEADER_SIZE(0)) / FRAME_VALUE_SIZE(0))
+
+/* Max number of distinct (deviceId, measurementType) streams in one frame */
+#define FRAME_MAX_STREAMS (32)
+
+/*
+* Policy ack sent by the server after a flush (little endian):
+*
+*   uint32 magic | uint8 mask | uint8 tolerance_percentage | uint8 tolerance_percentage_critical |
+*   uint8 compression_mode | uint16 max_length | uint16 transmission_buffer_size | uint32 max_time |
+*   float sdt_deviation | int64 send time of the batch | uint32 hold time
+*
+* Only the fields flagged in mask are applied, a mask of 0 is a plain ack. The
+* send time is echoed back so the node can measure the round trip time. The
+* hold time is the time in microseconds the server kept the batch before the
+* ack, waiting for it to be durable; it is taken off the round trip time, so
+* only the network is left in it.
+* POLICY_REPORT_REQUEST asks the node to send its whole policy with the next batch.
+*/
+#define FRAME_POLICY_MAGIC 0x314C4F50u  // "POL1"
+#define FRAME_POLICY_SIZE (32)
+#define POLICY_MAX_LENGTH (1 << 0)
+#define POLICY_MAX_TIME (1 << 1)
+#define POLICY_TRANSMISSION_BUFFER_SIZE (1 << 2)
+#define POLICY_TOLERANCE_PERCENTAGE (1 << 3)
+#define POLICY_TOLERANCE_PERCENTAGE_CRITICAL (1 << 4)
+#define POLICY_COMPRESSION_MODE (1 << 5)
+#define POLICY_SDT_DEVIATION (1 << 6)
+#define POLICY_REPORT_REQUEST (1 << 7)
+
+/**
+ * @brief Header of a batch.
+ */
+struct frame_batch {
+  uint8_t mode;         /**< Compression mode of the samples. */
+  uint8_t flags;        /**< FRAME_FLAG_* */
+  uint16_t count;       /**< Number of samples. */
+  int64_t base_time;    /**< Timestamp of the first sample. */
+  int64_t send_time;    /**< Time of the node when the batch was sent. */
+  uint32_t last_rtt;    /**< Round trip time of the previous batch, 0 if unknown. */
+  uint32_t policy_hash;         /**< Hash of the policy of the node, with FRAME_FLAG_POLICY. */
+  struct driver_policy policy;  /**< Policy of the node, hashed with FRAME_FLAG_POLICY and sent with FRAME_FLAG_POLICY_REPORT. */
+};
+
+/**
+ * @brief Pending samples waiting to be merged into one aggregated frame.
+ */
+struct frame_aggregator {
+  struct sensor samples[FRAME_MAX_SAMPLES];  /**< Samples in arrival order. */
+  uint8_t stream_of[FRAME_MAX_SAMPLES];      /**< Stream of each sample. */
+  size_t n_samples;                          /**< Number of pending samples. */
+  struct {
+    int deviceId;
+    int measurementType;
+    uint8_t mode;
+    uint16_t count;
+    uint32_t first_sequence;
+    int64_t base_time;
+  } streams[FRAME_MAX_STREAMS];              /**< Streams in order of first arrival. */
+  size_t n_streams;                          /**< Number of distinct streams. */
+  size_t frame_size;                         /**< Encoded size of the pending samples in bytes. */
+  uint8_t flags;                             /**< FRAME_FLAG_* of the frames. */
+  int64_t first_time;                        /**< Time of the aggregator when the oldest pending sample arrived. */
+};
+
+/*
+ * Forwards the frame of an aggregator that can not take the next sample.
+ *
+ * @param agg The aggregator, to be encoded with frame_aggregator_encode().
+ * @param ctx The ctx given to frame_aggregator_add_batch().
+ */
+typedef void (*frame_forward_t)(struct frame_aggregator *agg, void *ctx);
+
+/*
+ * Writes the report of a policy, as sent in a batch.
+ *
+ * @param buf Where the report is written, FRAME_POLICY_REPORT_SIZE bytes.
+ * @param policy The policy to be reported.
+ */
+void frame_policy_encode(uint8_t *buf, const struct driver_policy *policy);
+
+/*
+ * Computes the hash of a policy, the FNV-1a of its report.
+ *
+ * @param policy The policy.
+ *
+ * @return The hash.
+ */
+uint32_t frame_policy_hash(const struct driver_policy *policy);
+
+/*
+ * Writes the header of a batch.
+ *
+ * With FRAME_FLAG_POLICY the hash of batch->policy is computed and written,
+ * policy_hash is not used.
+ *
+ * @param buf The start of the batch, at least FRAME_BATCH_HEADER_SIZE(batch->flags) bytes.
+ * @param batch The header to be written.
+ */
+void frame_batch_header(uint8_t *buf, const struct frame_batch *batch);
+
+/*
+ * Writes one sample of a batch.
+ *
+ * @param buf Where the sample is written, at least FRAME_BATCH_RECORD_SIZE(batch->flags) bytes.
+ * @param batch The header of the batch, with the base time already set.
+ * @param sample The sample to be written.
+ *
+ * @return The number of bytes written.
+ */
+size_t frame_batch_record(uint8_t *buf, const struct frame_batch *batch, const struct sensor *sample);
+
+/*
+ * Reads the header of a batch.
+ *
+ * @param buf The batch.
+ * @param len The size of the batch in bytes.
+ * @param batch Where the header is stored. The policy is only read with FRAME_FLAG_POLICY_REPORT.
+ *
+ * @return false if the header is invalid or the batch is truncated.
+ */
+bool frame_batch_decode_header(const uint8_t *buf, size_t len, struct frame_batch *batch);
+
+/*
+ * Reads one sample of a batch.
+ *
+ * @param buf The sample, FRAME_BATCH_RECORD_SIZE(batch->flags) bytes.
+ * @param batch The header of the batch.
+ * @param sample Where the sample is stored, with the mode of the batch. The timestamp is 0 if the batch has none.
+ */
+void frame_batch_decode_record(const uint8_t *buf, const struct frame_batch *batch, struct sensor *sample);
+
+/*
+ * Initializes an empty aggregator.
+ *
+ * @param agg The aggregator.
+ * @param flags FRAME_FLAG_* of the frames to be encoded.
+ */
+void frame_aggregator_init(struct frame_aggregator *agg, uint8_t flags);
+
+/*
+ * Clears all the pending samples of the aggregator.
+ *
+ * @param agg The aggregator to be cleared.
+ */
+void frame_aggregator_reset(struct frame_aggregator *agg);
+
+/*
+ * Adds a sample to the aggregator.
+ *
+ * @param agg The aggregator.
+ * @param sample The sample to be added, with its timestamp in the clock of the aggregator.
+ * @param mode The compression mode of the batch of the sample.
+ *
+ * @return false if the sample does not fit in the current frame. In this case the
+ * frame must be encoded and sent before the sample is added again.
+ */
+bool frame_aggregator_add(struct frame_aggregator *agg, const struct sensor *sample, uint8_t mode);
+
+/*
+ * Adds the samples of a batch of a node to the aggregator.
+ *
+ * The timestamps of the node are translated to the clock of the aggregator
+ * with the send time of the batch, the latency of the local network is
+ * neglected. The samples of a batch without timestamps are stamped with now.
+ * When the frame is full it is handed to forward, and a new one is started.
+ *
+ * @param agg The aggregator.
+ * @param data The batch, as built by the transmission handler.
+ * @param data_len The size of the batch in bytes.
+ * @param now The time of the aggregator when the batch arrived.
+ * @param forward Sends the full frames.
+ * @param ctx Passed to forward.
+ *
+ * @return false if the batch is invalid.
+ */
+bool frame_aggregator_add_batch(struct frame_aggregator *agg, const uint8_t *data, size_t data_len, int64_t now,
+                                frame_forward_t forward, void *ctx);
+
+/*
+ * Encodes the pending samples into one aggregated frame and resets the aggregator.
+ *
+ * @param agg The aggregator.
+ * @param buf The destination buffer.
+ * @param len The size of the destination buffer, at least TRANSMISSION_BUFFER_SIZE.
+ * @param send_time The time of the aggregator when the frame is sent.
+ *
+ * @return The number of bytes written to buf, 0 if there is nothing to send.
+ */
+size_t frame_aggregator_encode(struct frame_aggregator *agg, uint8_t *buf, size_t len, int64_t send_time);
+
+/*
+ * Applies the policy delta of a server ack to a policy.
+ *
+ * @param buf The ack received from the server.
+ * @param len The number of bytes received.
+ * @param policy The policy to be updated. Fields not flagged in the ack are kept.
+ *
+ * @return The mask of the updated fields, 0 if the ack has no delta or is invalid.
+ */
+uint8_t frame_decode_policy(const uint8_t *buf, size_t len, struct driver_policy *policy);
+
+/*
+ * Reads the send time of the batch echoed in a server ack, and the time the server held the ack.
+ *
+ * @param buf The ack received from the server.
+ * @param len The number of bytes received.
+ * @param send_time Where the echoed send time is stored.
+ * @param hold Where the hold time of the server is stored, in microseconds.
+ *
+ * @return false if the ack is invalid.
+ */
+bool frame_decode_ack_time(const uint8_t *buf, size_t len, int64_t *send_time, uint32_t *hold);
+
+
+#endif
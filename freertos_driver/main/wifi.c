@@ -11,6 +11,11 @@ static const char *TAG="tcp_client";
 // Define global variables here (if any)
 int s, r;
 
+// Socket kept open by the aggregator between flushes, -1 when disconnected
+static int persistent_socket = -1;
+// Socket used by a peer node to reach the aggregator
+static int aggregator_socket = -1;
+
 
 void wifi_connect(){
     wifi_config_t cfg = {
@@ -111,4 +116,152 @@ void send_data_buffer(uint8_t *data, size_t data_len){
     ESP_LOGI(TAG, "... socket send success");
         close(s);
 
-}
\ No newline at end of file
+}
+
+/*
+ * Sends a buffer over its own connection and waits for the ack of the server.
+ *
+ * The socket is local to the call, so the instances of the driver can send at
+ * the same time from their own tasks. The write side of the connection is shut
+ * down after the buffer, so the server knows the batch is complete and answers
+ * with its ack (see frame.h). It does not wait after a failure, the driver
+ * backs off on its own.
+ *
+ * @return The number of bytes of the ack, or -1 if it was not received.
+ */
+int send_data_buffer_ack(uint8_t *data, size_t data_len, uint8_t *ack, size_t ack_len){
+
+    struct timeval timeout = { .tv_sec = POLICY_ACK_TIMEOUT / 1000, .tv_usec = (POLICY_ACK_TIMEOUT % 1000) * 1000 };
+    struct sockaddr_in tcpServerAddr;
+    size_t sent = 0;
+    int received = 0;
+    int sock;
+    int len;
+
+    tcpServerAddr.sin_addr.s_addr = inet_addr(TCPServerIP);
+    tcpServerAddr.sin_family = AF_INET;
+    tcpServerAddr.sin_port = htons( 1010 );
+
+    xEventGroupWaitBits(wifi_event_group,CONNECTED_BIT,false,true,portMAX_DELAY);
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if(sock < 0) {
+        ESP_LOGE(TAG, "... Failed to allocate socket.\n");
+        return -1;
+    }
+    if(connect(sock, (struct sockaddr *)&tcpServerAddr, sizeof(tcpServerAddr)) != 0) {
+        ESP_LOGE(TAG, "... socket connect failed errno=%d \n", errno);
+        close(sock);
+        return -1;
+    }
+
+    while(sent < data_len){
+        len = send(sock, &data[sent], data_len - sent, 0);
+        if(len <= 0){
+            ESP_LOGE(TAG, "... Send failed \n");
+            close(sock);
+            return -1;
+        }
+        sent += (size_t)len;
+    }
+    ESP_LOGI(TAG, "... socket send success");
+
+    shutdown(sock, SHUT_WR);
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while((size_t)received < ack_len && (len = recv(sock, &ack[received], ack_len - received, 0)) > 0){
+        received += len;
+    }
+    close(sock);
+
+    if(received == 0){
+        ESP_LOGE(TAG, "... no ack from the server \n");
+        return -1;
+    }
+    return received;
+}
+
+/*
+ * Sends a frame over a connection that is kept open between flushes.
+ *
+ * The connection is opened on the first call and reopened after a failure,
+ * so the aggregator pays the TCP handshake only once.
+ *
+ * Returns 0 once the whole frame was handed to the TCP stack, -1 otherwise. The
+ * server does not ack the frames, so bytes accepted by the stack are lost if the
+ * connection breaks before they are delivered.
+ */
+int send_data_persistent(uint8_t *data, size_t data_len){
+
+    size_t sent = 0;
+    int len;
+
+    if(persistent_socket < 0){
+        struct sockaddr_in tcpServerAddr;
+        tcpServerAddr.sin_addr.s_addr = inet_addr(TCPServerIP);
+        tcpServerAddr.sin_family = AF_INET;
+        tcpServerAddr.sin_port = htons( 1010 );
+
+        xEventGroupWaitBits(wifi_event_group,CONNECTED_BIT,false,true,portMAX_DELAY);
+        persistent_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if(persistent_socket < 0) {
+            ESP_LOGE(TAG, "... Failed to allocate socket.\n");
+            vTaskDelay(1000 / portTICK_PERIOD_MS);
+            return -1;
+        }
+        if(connect(persistent_socket, (struct sockaddr *)&tcpServerAddr, sizeof(tcpServerAddr)) != 0) {
+            ESP_LOGE(TAG, "... socket connect failed errno=%d \n", errno);
+            close(persistent_socket);
+            persistent_socket = -1;
+            vTaskDelay(4000 / portTICK_PERIOD_MS);
+            return -1;
+        }
+        ESP_LOGI(TAG, "... persistent socket connected\n");
+    }
+
+    //a frame cut in the middle would desynchronize the stream of the server
+    while(sent < data_len){
+        len = send(persistent_socket, &data[sent], data_len - sent, 0);
+        if(len <= 0){
+            ESP_LOGE(TAG, "... Send failed \n");
+            close(persistent_socket);
+            persistent_socket = -1;
+            return -1;
+        }
+        sent += (size_t)len;
+    }
+    ESP_LOGI(TAG, "... socket send success");
+    return 0;
+}
+
+/*
+ * Sends a batch to the aggregator of the network over UDP.
+ *
+ * The batch must fit in one datagram of PEER_FRAME_SIZE bytes: lwIP does not
+ * reassemble fragmented IPv4 packets by default, so the aggregator would drop it.
+ */
+void send_data_aggregator(uint8_t *data, size_t data_len){
+
+    if(data_len > PEER_FRAME_SIZE){
+        ESP_LOGE(TAG, "... batch of %u bytes does not fit in one datagram \n", (unsigned)data_len);
+        return;
+    }
+
+    struct sockaddr_in aggregatorAddr;
+    aggregatorAddr.sin_addr.s_addr = inet_addr(AggregatorIP);
+    aggregatorAddr.sin_family = AF_INET;
+    aggregatorAddr.sin_port = htons( AGGREGATOR_PORT );
+
+    xEventGroupWaitBits(wifi_event_group,CONNECTED_BIT,false,true,portMAX_DELAY);
+    if(aggregator_socket < 0){
+        aggregator_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if(aggregator_socket < 0) {
+            ESP_LOGE(TAG, "... Failed to allocate socket.\n");
+            return;
+        }
+    }
+
+    if(sendto(aggregator_socket, &data[0], data_len, 0, (struct sockaddr *)&aggregatorAddr, sizeof(aggregatorAddr)) < 0){
+        ESP_LOGE(TAG, "... Send to aggregator failed \n");
+        return;
+    }
+    ESP_LOGI(TAG, "... aggregator send success");
+}
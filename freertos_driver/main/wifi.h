@@ -25,6 +25,7 @@
 #define SSID "SSID"
 #define PASSPHARSE "PASSWORD"
 #define TCPServerIP "192.168.102.188"
+#define AggregatorIP "192.168.102.189"
 
 #define MESSAGE "HelloTCPServer"
 
@@ -35,7 +36,10 @@ void initialise_wifi(void);
 void tcp_client(void);
 void send_data(struct sensor *sensor_data);
 void send_data_buffer(uint8_t *data, size_t data_len);
+int send_data_buffer_ack(uint8_t *data, size_t data_len, uint8_t *ack, size_t ack_len);
 void close_socket(void);
+int send_data_persistent(uint8_t *data, size_t data_len);
+void send_data_aggregator(uint8_t *data, size_t data_len);
 
 
 #endif /* WIFI_H */
@@ -0,0 +1,206 @@
+import struct
+from collections import namedtuple
+
+# Compression modes of the driver (see freertos_driver/main/driver.h)
+COMPRESSION_DEADBAND = 0
+COMPRESSION_SWINGING_DOOR = 1
+
+# Frames with the timestamps of the samples and the time of the sender
+FRAME_FLAG_TIMESTAMP = 1 << 0
+# Batches with the hash of the policy of the node, and with the whole policy
+FRAME_FLAG_POLICY = 1 << 1
+FRAME_FLAG_POLICY_REPORT = 1 << 2
+
+# timestamp is in microseconds of the clock of the sender, None if the frame has no timestamps
+Sample = namedtuple('Sample', 'device_id measurement_type value sequence mode timestamp')
+
+# Time of the sender when a frame was sent, used to estimate its clock.
+# last_rtt is the round trip time of its previous batch in microseconds, 0 if unknown.
+FrameClock = namedtuple('FrameClock', 'send_time last_rtt')
+
+# Policy a node runs, reported in its batch: the hash of the policy, and the
+# dict of its POLICY_FIELDS when the batch carries the whole policy, else None.
+PolicyReport = namedtuple('PolicyReport', 'hash policy')
+
+# Format of one struct sensor record sent by a node.
+# The format of the struct depends on the data you expect to receive.
+# For example, if you are expecting four integers, use "i i i i".
+struct_format = "<i i f I"
+struct_size = struct.calcsize(struct_format)
+delta_format = "<I"  # timestamp - base time, after the record with FRAME_FLAG_TIMESTAMP
+delta_size = struct.calcsize(delta_format)
+
+# Batch sent by a node on each flush (see freertos_driver/main/frame.h)
+BATCH_MAGIC = 0x31544142  # "BAT1"
+batch_header_format = "<I B B H"  # magic, compression mode, flags, number of samples
+batch_header_size = struct.calcsize(batch_header_format)
+batch_time_format = "<q q I"  # base time, send time, last round trip time
+batch_time_size = struct.calcsize(batch_time_format)
+policy_hash_format = "<I"  # FNV-1a of the policy report, with FRAME_FLAG_POLICY
+policy_hash_size = struct.calcsize(policy_hash_format)
+# tolerances, compression mode, padding, max_length, buffer size, max_time, sdt deviation
+policy_report_format = "<B B B x H H I f"
+policy_report_size = struct.calcsize(policy_report_format)
+
+# Aggregated frames forwarded by an aggregator node (see freertos_driver/main/frame.h)
+AGGREGATED_MAGIC = 0x31474741  # "AGG1"
+frame_header_format = "<I H B B"  # magic, payload length, number of groups, flags
+frame_header_size = struct.calcsize(frame_header_format)
+time_format = "<q"  # send time of the frame or base time of a group, with FRAME_FLAG_TIMESTAMP
+time_size = struct.calcsize(time_format)
+group_header_format = "<i i B H I"  # deviceId, measurementType, compression mode, number of values, first sequence
+group_header_size = struct.calcsize(group_header_format)
+value_format = "<H f"  # sequence - first sequence, value
+value_size = struct.calcsize(value_format)
+
+
+def is_aggregated(data):
+    """Return True if the stream starts with an aggregated frame."""
+    return len(data) >= 4 and struct.unpack_from("<I", data)[0] == AGGREGATED_MAGIC
+
+
+def policy_hash(report):
+    """FNV-1a of the bytes of a policy report, as frame_policy_hash() of the driver."""
+    value = 2166136261
+    for byte in report:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def decode_batch(data):
+    """Decode the complete batches of data.
+
+    Returns the list of Sample, the FrameClock of the batches with timestamps,
+    the PolicyReport of the batches with a policy and the bytes left over.
+    """
+    samples = []
+    clocks = []
+    reports = []
+    while len(data) >= batch_header_size:
+        magic, mode, flags, count = struct.unpack_from(batch_header_format, data)
+        if magic != BATCH_MAGIC:
+            raise ValueError('invalid batch magic 0x{:08x}'.format(magic))
+        timestamped = flags & FRAME_FLAG_TIMESTAMP
+        policy_size = 0
+        if flags & FRAME_FLAG_POLICY:
+            policy_size = policy_hash_size + (policy_report_size if flags & FRAME_FLAG_POLICY_REPORT else 0)
+        header_size = batch_header_size + (batch_time_size if timestamped else 0) + policy_size
+        record_size = struct_size + (delta_size if timestamped else 0)
+        if len(data) < header_size + count * record_size:
+            break
+
+        base_time = None
+        if timestamped:
+            base_time, send_time, last_rtt = struct.unpack_from(batch_time_format, data, batch_header_size)
+            clocks.append(FrameClock(send_time, last_rtt))
+        if policy_size:
+            offset = header_size - policy_size
+            report_hash = struct.unpack_from(policy_hash_format, data, offset)[0]
+            policy = None
+            if flags & FRAME_FLAG_POLICY_REPORT:
+                raw = data[offset + policy_hash_size:header_size]
+                if policy_hash(raw) != report_hash:
+                    raise ValueError('policy report does not match its hash')
+                policy = dict(zip(POLICY_REPORT_FIELDS, struct.unpack(policy_report_format, raw)))
+            reports.append(PolicyReport(report_hash, policy))
+
+        offset = header_size
+        for _ in range(count):
+            device_id, measurement_type, value, sequence = struct.unpack_from(struct_format, data, offset)
+            timestamp = None
+            if timestamped:
+                timestamp = base_time + struct.unpack_from(delta_format, data, offset + struct_size)[0]
+            samples.append(Sample(device_id, measurement_type, value, sequence, mode, timestamp))
+            offset += record_size
+
+        data = data[offset:]
+    return samples, clocks, reports, data
+
+
+def decode_aggregated(data):
+    """Decode the complete aggregated frames of data.
+
+    Returns the list of Sample, the FrameClock of the frames with timestamps
+    and the bytes left over, which belong to a frame that has not been fully
+    received yet. The timestamps are in the clock of the aggregator.
+    """
+    samples = []
+    clocks = []
+    while len(data) >= frame_header_size:
+        magic, payload_len, groups, flags = struct.unpack_from(frame_header_format, data)
+        if magic != AGGREGATED_MAGIC:
+            raise ValueError('invalid frame magic 0x{:08x}'.format(magic))
+        timestamped = flags & FRAME_FLAG_TIMESTAMP
+        header_size = frame_header_size + (time_size if timestamped else 0)
+        if len(data) < header_size + payload_len:
+            break
+
+        if timestamped:
+            # the aggregator keeps its connection open and gets no ack, so the round trip is unknown
+            clocks.append(FrameClock(struct.unpack_from(time_format, data, frame_header_size)[0], 0))
+
+        offset = header_size
+        for _ in range(groups):
+            device_id, measurement_type, mode, count, first_sequence = \
+                struct.unpack_from(group_header_format, data, offset)
+            offset += group_header_size
+            base_time = None
+            if timestamped:
+                base_time = struct.unpack_from(time_format, data, offset)[0]
+                offset += time_size
+            for _ in range(count):
+                delta, value = struct.unpack_from(value_format, data, offset)
+                offset += value_size
+                timestamp = None
+                if timestamped:
+                    timestamp = base_time + struct.unpack_from(delta_format, data, offset)[0]
+                    offset += delta_size
+                samples.append(Sample(device_id, measurement_type, value, first_sequence + delta, mode, timestamp))
+
+        data = data[header_size + payload_len:]
+    return samples, clocks, data
+
+
+# Policy ack sent back to a standalone node after its batch (see freertos_driver/main/frame.h)
+POLICY_MAGIC = 0x314C4F50  # "POL1"
+# magic, mask, tolerances, compression mode, max_length, buffer size, max_time, sdt deviation,
+# echo of the send time of the batch, time the server held the ack in microseconds
+policy_format = "<I B B B B H H I f q I"
+# Ask the node to report its whole policy with its next batch
+POLICY_REPORT_REQUEST = 1 << 7
+
+# Fields of a policy report, in the order of policy_report_format
+POLICY_REPORT_FIELDS = ('tolerance_percentage', 'tolerance_percentage_critical', 'compression_mode',
+                        'max_length', 'transmission_buffer_size', 'max_time', 'sdt_deviation')
+
+POLICY_FIELDS = {
+    # name: mask bit
+    'max_length': 1 << 0,
+    'max_time': 1 << 1,
+    'transmission_buffer_size': 1 << 2,
+    'tolerance_percentage': 1 << 3,
+    'tolerance_percentage_critical': 1 << 4,
+    'compression_mode': 1 << 5,
+    'sdt_deviation': 1 << 6,
+}
+
+
+def encode_policy_ack(delta=None, send_time=0, request_report=False, hold=0):
+    """Encode the ack of a batch, with the policy fields of delta to be changed on the node.
+
+    send_time is echoed back so the node can measure the round trip time of the batch,
+    less hold, the microseconds the server kept the batch before the ack.
+    With request_report the node sends its whole policy with its next batch.
+    """
+    delta = delta or {}
+    mask = POLICY_REPORT_REQUEST if request_report else 0
+    values = {}
+    for name, bit in POLICY_FIELDS.items():
+        if name in delta:
+            mask |= bit
+        values[name] = delta.get(name, 0)
+    return struct.pack(policy_format, POLICY_MAGIC, mask,
+                       values['tolerance_percentage'], values['tolerance_percentage_critical'],
+                       values['compression_mode'], values['max_length'], values['transmission_buffer_size'],
+                       values['max_time'], values['sdt_deviation'], send_time,
+                       max(0, min(hold, 0xFFFFFFFF)))
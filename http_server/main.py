@@ -1,51 +1,162 @@
-import struct
 import socket
+import threading
+import time
+from datetime import datetime
 
-# Define the structure of the struct
-# The format of the struct depends on the data you expect to receive.
-# For example, if you are expecting four integers, use "i i i i".
-struct_format = "i i f"
-
-struct_size = struct.calcsize(struct_format)
+from frames import is_aggregated, decode_batch, decode_aggregated, encode_policy_ack
+from policy import PolicyStore
+from reconstruction import Reconstructor
+from timesync import ClockSync
+from wal import WriteAheadLog, RECORD_AGGREGATED, RECORD_BATCH
 
 # Set the server's IP address and port
 server_ip = '192.168.1.112'
 server_port = 1010
 
-# Create the TCP socket
-server_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+# Write-ahead log of the frames received: one fsync per group of frames,
+# committed wal_commit_interval seconds after its first frame or at wal_commit_bytes
+wal_path = 'ingest.wal'
+wal_commit_interval = 0.005
+wal_commit_bytes = 64 * 1024
+# Max wait for a batch to be durable, below POLICY_ACK_TIMEOUT of the driver
+wal_ack_timeout = 1.0
+
+# Policies pushed to the nodes in the ack of their batches
+policies = PolicyStore('policy.json')
+
+# Rebuilds the samples not sent by the nodes in swinging-door mode and drops the ones sent twice
+reconstructor = Reconstructor()
+
+# Maps the timestamps of the nodes to the clock of the server
+clocks = ClockSync()
 
-# Bind the server socket to the specified address and port
-server_address = (server_ip, server_port)
-server_socket.bind(server_address)
+# Opened in main()
+wal = None
 
-server_socket.listen(1)
 
-print('Server waiting for connection on IP:', server_ip, 'Port:', server_port)
+def print_samples(samples, node, aggregated=False):
+    # the deviceIds of an aggregated network are unique, the ones of standalone nodes only within a node
+    stream_node = None if aggregated else node
+    for sensor_data in samples:
+        for sequence, timestamp, value, interpolated in reconstructor.feed(sensor_data, stream_node):
+            # Print the data separately
+            print('deviceId:', sensor_data.device_id)
+            print('measurementType:', sensor_data.measurement_type)
+            print('sequence:', sequence)
+            server_time = clocks.to_server(node, timestamp)
+            if server_time is not None:
+                print('timestamp:', datetime.fromtimestamp(server_time).isoformat(timespec='milliseconds'))
+            print('value: {:.2f}{}'.format(value, ' (interpolated)' if interpolated else ''))
+            #print('errorCode:', sensor_data[3])  # Uncomment this line if necessary
+            print('---')  # Separator between structures
 
-while True:
-    # Accept a connection
-    client_socket, client_address = server_socket.accept()
+
+def is_durable(offset):
+    try:
+        return wal.wait_durable(offset, timeout=wal_ack_timeout)
+    except OSError as error:
+        print('Write-ahead log error:', error)
+        return False
+
+
+def handle_client(client_socket, client_address):
     print('Client connected:', client_address)
 
-    # Receive the data buffer
-    data = client_socket.recv(1024)
+    # A standalone node sends one batch per connection.
+    # An aggregator keeps the connection open and sends aggregated frames.
+    # The clock of an aggregator is the one of the frames, its peers are already translated to it
+    node = client_address[0]
+    data = b''
+    aggregated = None
+    send_time = 0
+    send_recv_time = None
+    report = None
+    offset = None
+    # the samples of a standalone node are only used once they are durable, the node sends them again otherwise
+    batch_samples = []
+    try:
+        while True:
+            chunk = client_socket.recv(4096)
+            recv_time = time.time()
+            if not chunk:
+                break
+            data += chunk
 
-    # Check if there is enough data for at least one structure
-    while len(data) >= struct_size:
-        # Unpack the data from the struct
-        sensor_data = struct.unpack(struct_format, data[:struct_size])
+            if aggregated is None:
+                if len(data) < 4:
+                    continue
+                aggregated = is_aggregated(data)
 
-        # Print the data separately
-        print('deviceId:', sensor_data[0])
-        print('measurementType:', sensor_data[1])
-        print('value: {:.2f}'.format(sensor_data[2]))
-        #print('timestamp:', sensor_data[3])  # Uncomment this line if necessary
-        #print('errorCode:', sensor_data[3])  # Uncomment this line if necessary
-        print('---')  # Separator between structures
+            received = data
+            if aggregated:
+                samples, frame_clocks, data = decode_aggregated(data)
+            else:
+                samples, frame_clocks, reports, data = decode_batch(data)
+                if reports:
+                    report = reports[-1]
+            # the complete frames are logged as received, before they are used
+            frames = received[:len(received) - len(data)]
+            if frames:
+                offset = wal.append(node, RECORD_AGGREGATED if aggregated else RECORD_BATCH, frames, recv_time)
+            for frame_clock in frame_clocks:
+                clocks.observe(node, frame_clock.send_time, recv_time, frame_clock.last_rtt)
+                send_time = frame_clock.send_time
+                send_recv_time = recv_time
+            if aggregated:
+                print_samples(samples, node, aggregated=True)
+            else:
+                batch_samples.extend(samples)
+    except ValueError as error:
+        # a corrupt frame is neither logged nor acked, the node sends its batch again
+        print('Invalid frame from', client_address[0], error)
+        client_socket.close()
+        print('Client disconnected:', client_address)
+        return
 
-        # Remove the data from the structure from the buffer
-        data = data[struct_size:]
+    # A standalone node waits for the ack of its batch, which may carry a policy delta
+    # against the policy reported in the batch, or ask for the whole policy.
+    # The ack tells the node it can free the batch, so it is only sent once the batch is durable,
+    # and not for a connection that ended before a whole batch or in the middle of one.
+    # Without the ack the node keeps the batch and sends it again.
+    if not aggregated and offset is not None and data == b'' and is_durable(offset):
+        print_samples(batch_samples, node)
+        delta, request_report = policies.ack_for(node, report)
+        if delta:
+            print('Policy update for', node, delta)
+        # the wait for the log is not network latency, the node takes it off its round trip time
+        hold = round((time.time() - send_recv_time) * 1e6) if send_recv_time is not None else 0
+        client_socket.sendall(encode_policy_ack(delta, send_time, request_report, hold))
+    elif not aggregated and (offset is None or data != b''):
+        print('Incomplete batch from', client_address[0] + ', no ack')
+    elif not aggregated:
+        print('Batch of', client_address[0], 'not durable, no ack')
 
     # Close the connection with the client
     client_socket.close()
+    print('Client disconnected:', client_address)
+
+
+def main():
+    global wal
+    wal = WriteAheadLog(wal_path, wal_commit_interval, wal_commit_bytes)
+
+    # Create the TCP socket
+    server_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+
+    # Bind the server socket to the specified address and port
+    server_address = (server_ip, server_port)
+    server_socket.bind(server_address)
+
+    server_socket.listen(5)
+
+    print('Server waiting for connection on IP:', server_ip, 'Port:', server_port)
+
+    while True:
+        # Accept a connection, each client is served by its own thread so a
+        # persistent aggregator connection does not block the other nodes
+        client_socket, client_address = server_socket.accept()
+        threading.Thread(target=handle_client, args=(client_socket, client_address), daemon=True).start()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,148 @@
+"""Micro-benchmarks of the per-sample paths of the server.
+
+Each kernel runs over the same frames, a few times, and the fastest run is
+reported in nanoseconds per sample, as JSON on stdout, in the format of
+freertos_driver/host/micro_bench.c, so both can be compared with their stored
+baselines by freertos_driver/host/bench_compare.py (make microbench).
+
+  decode_batch       decode_batch() of the batches of a standalone node, one call per batch
+  decode_aggregated  decode_aggregated() of the frames of an aggregator, one call per frame
+  reconstruct        Reconstructor.feed() of the decoded samples
+
+A fixed loop that does not depend on the server, the calibration, runs right
+before every run of a kernel. The median ratio of each kernel to it is reported
+as "relative", which bench_compare.py compares, so a busier or idler host, or
+another machine, does not show as a change of the code.
+
+Usage: python3 micro_bench.py [--samples 50000] [--runs 7]
+"""
+import argparse
+import gc
+import json
+import math
+import random
+import statistics
+import struct
+import time
+
+from frames import (BATCH_MAGIC, AGGREGATED_MAGIC, FRAME_FLAG_TIMESTAMP, COMPRESSION_DEADBAND,
+                    struct_format, delta_format, batch_header_format, batch_time_format,
+                    frame_header_format, time_format, group_header_format, value_format,
+                    decode_batch, decode_aggregated)
+from reconstruction import Reconstructor
+
+# Same frames as the driver with TRANSMISSION_BUFFER_SIZE 1500 and ENABLE_TIMESTAMP
+BATCH_SAMPLES = 73
+STREAMS = 4
+GROUP_SAMPLES = 30
+
+
+def trace(samples):
+    """Vibration of a few streams, interleaved, with 1 ms between samples: (device, sequence, timestamp, value)."""
+    rng = random.Random(1)
+    return [(i % STREAMS, i // STREAMS, (i // STREAMS) * 1000,
+             10.0 + math.sin(2 * math.pi * 5 * (i // STREAMS) / 1000) + rng.uniform(-0.1, 0.1))
+            for i in range(samples)]
+
+
+def encode_batches(points):
+    batches = []
+    for start in range(0, len(points), BATCH_SAMPLES):
+        chunk = points[start:start + BATCH_SAMPLES]
+        base_time = chunk[0][2]
+        frame = struct.pack(batch_header_format, BATCH_MAGIC, COMPRESSION_DEADBAND, FRAME_FLAG_TIMESTAMP, len(chunk))
+        frame += struct.pack(batch_time_format, base_time, base_time, 0)
+        for device, sequence, timestamp, value in chunk:
+            frame += struct.pack(struct_format, device, 2, value, sequence)
+            frame += struct.pack(delta_format, timestamp - base_time)
+        batches.append(frame)
+    return batches
+
+
+def encode_aggregated(points):
+    frames = []
+    for start in range(0, len(points), STREAMS * GROUP_SAMPLES):
+        chunk = points[start:start + STREAMS * GROUP_SAMPLES]
+        payload = b''
+        for stream in range(STREAMS):
+            group = [point for point in chunk if point[0] == stream]
+            if not group:
+                continue
+            base_time = group[0][2]
+            payload += struct.pack(group_header_format, stream, 2, COMPRESSION_DEADBAND, len(group), group[0][1])
+            payload += struct.pack(time_format, base_time)
+            for _, sequence, timestamp, value in group:
+                payload += struct.pack(value_format, sequence - group[0][1], value)
+                payload += struct.pack(delta_format, timestamp - base_time)
+        groups = len({point[0] for point in chunk})
+        frames.append(struct.pack(frame_header_format, AGGREGATED_MAGIC, len(payload), groups, FRAME_FLAG_TIMESTAMP) +
+                      struct.pack(time_format, chunk[-1][2]) + payload)
+    return frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--samples', type=int, default=50000)
+    parser.add_argument('--runs', type=int, default=7)
+    args = parser.parse_args()
+
+    points = trace(args.samples)
+    batches = encode_batches(points)
+    aggregated = encode_aggregated(points)
+    samples = [sample for batch in batches for sample in decode_batch(batch)[0]]
+    assert len(samples) == args.samples
+    assert sum(len(decode_aggregated(frame)[0]) for frame in aggregated) == args.samples
+
+    def run_decode_batch():
+        for batch in batches:
+            decode_batch(batch)
+
+    def run_decode_aggregated():
+        for frame in aggregated:
+            decode_aggregated(frame)
+
+    def run_reconstruct():
+        reconstructor = Reconstructor()
+        for sample in samples:
+            reconstructor.feed(sample)
+
+    def run_calibration():
+        state = 1
+        for sample in samples:
+            state = ((state ^ sample.sequence) * 1664525 + 1013904223) & 0xFFFFFFFF
+            state ^= state >> 13
+        return state
+
+    kernels = [('decode_batch', run_decode_batch),
+               ('decode_aggregated', run_decode_aggregated),
+               ('reconstruct', run_reconstruct)]
+
+    # the collector runs at the whim of the allocations of the previous kernels
+    gc.disable()
+    results = {}
+    relative = {}
+    calibration = math.inf
+    for name, run in kernels:
+        best = math.inf
+        ratios = []
+        # the first run warms up and is not counted
+        for r in range(args.runs + 1):
+            start = time.perf_counter_ns()
+            run_calibration()
+            middle = time.perf_counter_ns()
+            run()
+            end = time.perf_counter_ns()
+            if r > 0:
+                calibration = min(calibration, middle - start)
+                best = min(best, end - middle)
+                ratios.append((end - middle) / (middle - start))
+        results[name] = round(best / args.samples, 3)
+        relative[name] = round(statistics.median(ratios), 4)
+    results['calibration'] = round(calibration / args.samples, 3)
+
+    print(json.dumps({'suite': 'server', 'unit': 'ns/sample', 'samples': args.samples, 'runs': args.runs,
+                      'results': results, 'relative': relative}, indent=2))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,112 @@
+import json
+import os
+import struct
+import threading
+
+from frames import POLICY_FIELDS, encode_policy_ack
+
+# Number of acks with the same delta and the same reported policy before a warning;
+# a lost ack also repeats a delta, so the first repetitions are expected.
+UNAPPLIED_WARNING = 3
+
+
+class PolicyStore:
+    """Driver policies to be pushed to the nodes in the ack of their batches.
+
+    The policies are read from a JSON file, keyed by the IP address of the node,
+    with "default" applying to every node without its own entry:
+
+        {"default": {"max_time": 60000}, "192.168.1.20": {"max_length": 20}}
+
+    The file is reloaded when it changes, so the fleet can be tuned while the
+    server is running; an invalid file is logged and ignored.
+
+    The delta is computed against the policy the node reports in its batches,
+    not against what was pushed before, so a lost ack or a rejected policy is
+    pushed again. A node reports the hash of its policy in every batch and the
+    whole policy after a change; when the server does not know the hash, the
+    ack asks for the whole policy.
+    """
+
+    def __init__(self, path):
+        self.path = path
+        self.mtime = None
+        self.policies = {}
+        # node: last PolicyReport with the whole policy
+        self.reported = {}
+        # node: (hash, delta, number of acks) of the last delta pushed
+        self.pushed = {}
+        self.lock = threading.Lock()
+
+    def _reload(self):
+        try:
+            mtime = os.path.getmtime(self.path)
+        except OSError:
+            self.policies = {}
+            return
+        if mtime == self.mtime:
+            return
+        # A broken file is reported once and the last good policies stay in use,
+        # so a typo does not stop the acks of every node.
+        self.mtime = mtime
+        try:
+            with open(self.path) as policy_file:
+                policies = json.load(policy_file)
+            self._validate(policies)
+        except (OSError, ValueError, struct.error) as error:
+            print('Keeping the previous policies, {} is invalid: {}'.format(self.path, error))
+            return
+        self.policies = policies
+
+    @staticmethod
+    def _validate(policies):
+        if not isinstance(policies, dict):
+            raise ValueError('expected an object keyed by node')
+        for name, policy in policies.items():
+            if not isinstance(policy, dict):
+                raise ValueError('the policy of {} is not an object'.format(name))
+            unknown = set(policy) - set(POLICY_FIELDS)
+            if unknown:
+                raise ValueError('unknown policy fields for {}: {}'.format(name, ', '.join(sorted(unknown))))
+            try:
+                encode_policy_ack(policy)
+            except struct.error as error:
+                raise ValueError('bad policy value for {}: {}'.format(name, error))
+
+    def ack_for(self, node, report):
+        """Return (delta, request_report) of the ack of a batch of node.
+
+        report is the last PolicyReport of the batch, None if the node does not
+        report its policy; such a node gets plain acks.
+        """
+        with self.lock:
+            self._reload()
+            if report is None:
+                return {}, False
+            if report.policy is not None:
+                self.reported[node] = report
+            known = self.reported.get(node)
+            if known is None or known.hash != report.hash:
+                return {}, True
+
+            policy = dict(self.policies.get('default', {}))
+            policy.update(self.policies.get(node, {}))
+            delta = {name: value for name, value in policy.items()
+                     if not _same_value(name, value, known.policy[name])}
+            self._check_applied(node, report.hash, delta)
+            return delta, False
+
+    def _check_applied(self, node, report_hash, delta):
+        """Warn once when a node keeps running the policy it had before a delta, e.g. it rejected it."""
+        previous = self.pushed.get(node)
+        count = previous[2] + 1 if previous and previous[:2] == (report_hash, delta) else 1
+        self.pushed[node] = (report_hash, delta, count)
+        if delta and count == UNAPPLIED_WARNING:
+            print('Policy delta not applied by', node, 'after', count, 'acks:', delta)
+
+
+def _same_value(name, value, reported):
+    # the deviation travels as a float32
+    if name == 'sdt_deviation':
+        return struct.unpack('<f', struct.pack('<f', value))[0] == reported
+    return value == reported
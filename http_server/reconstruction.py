@@ -0,0 +1,64 @@
+import threading
+from collections import deque
+
+from frames import COMPRESSION_SWINGING_DOOR
+
+
+class Reconstructor:
+    """Rebuilds the samples that a node in swinging-door mode did not send.
+
+    In swinging-door mode the node only sends the endpoints of the segments of a
+    piecewise-linear approximation of the stream. Every sample between two
+    endpoints is within the deviation of the policy from the line joining them,
+    so the missing samples are rebuilt by linear interpolation on the sequence
+    number, and so are their timestamps. In dead-band mode the samples are returned as received, the value
+    holds until the next one.
+
+    A node sends a batch again when its ack is lost, so the samples already seen
+    are dropped by their (sequence, timestamp), against the last window samples
+    of each stream. The timestamp tells the samples of a node that rebooted, and
+    restarted its sequence numbers, from the ones sent twice.
+    """
+
+    def __init__(self, window=4096):
+        self.window = window
+        # (last sample, recent samples) of each stream
+        self.streams = {}
+        self.lock = threading.Lock()
+
+    def feed(self, sample, node=None):
+        """Return the (sequence, timestamp, value, interpolated) rows up to sample, in order.
+
+        timestamp is in the clock of the sender, None if the sample has none.
+        The streams of a standalone node are keyed by its node, as the nodes
+        reuse the same deviceIds; the samples of an aggregator are fed with
+        node None, their deviceIds are unique across its network.
+        A sample already seen returns no rows.
+        """
+        key = (node, sample.device_id, sample.measurement_type)
+        with self.lock:
+            stream = self.streams.get(key)
+            if stream is None:
+                stream = self.streams[key] = [None, deque(maxlen=self.window)]
+            last, recent = stream
+            # the sequence only goes back on a batch sent twice or on a reboot, the window is searched then
+            if last is not None and sample.sequence <= last.sequence and any(
+                    seen.sequence == sample.sequence and seen.timestamp == sample.timestamp for seen in recent):
+                return []
+            recent.append(sample)
+            stream[0] = sample
+
+        if (sample.mode != COMPRESSION_SWINGING_DOOR or last is None
+                or last.mode != COMPRESSION_SWINGING_DOOR or sample.sequence <= last.sequence):
+            return [(sample.sequence, sample.timestamp, sample.value, False)]
+
+        rows = []
+        gap = sample.sequence - last.sequence
+        for sequence in range(last.sequence + 1, sample.sequence):
+            value = last.value + (sample.value - last.value) * (sequence - last.sequence) / gap
+            timestamp = None
+            if sample.timestamp is not None and last.timestamp is not None:
+                timestamp = last.timestamp + (sample.timestamp - last.timestamp) * (sequence - last.sequence) // gap
+            rows.append((sequence, timestamp, value, True))
+        rows.append((sample.sequence, sample.timestamp, sample.value, False))
+        return rows
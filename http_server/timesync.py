@@ -0,0 +1,75 @@
+import threading
+from collections import deque
+
+
+class ClockSync:
+    """Maps the clock of each node to the clock of the server.
+
+    The nodes timestamp their samples with the microseconds since boot, which
+    start at an unknown offset and drift from the server clock. Each frame
+    carries the time of the node when it was sent; the server pairs it with the
+    time of arrival minus half the round trip time measured by the node, and
+    fits a line over the last points of the node. The slope of the line is the
+    drift of the clock of the node, so the correction holds between frames.
+    """
+
+    def __init__(self, window=32, min_span=60.0):
+        self.window = window
+        # below this span in seconds the jitter of the network dominates the slope
+        self.min_span = min_span
+        self.points = {}
+        self.lock = threading.Lock()
+
+    def observe(self, node, send_time, recv_time, last_rtt=0):
+        """Add one (send_time, recv_time) pair of node.
+
+        send_time is in microseconds of the node, recv_time in seconds of the
+        server and last_rtt in microseconds, 0 if unknown.
+        """
+        device = send_time / 1e6
+        server = recv_time - last_rtt / 2e6
+        with self.lock:
+            points = self.points.setdefault(node, deque(maxlen=self.window))
+            # the clock of the node went back: it rebooted, the old points no longer apply
+            if points and device < points[-1][0]:
+                points.clear()
+            points.append((device, server))
+
+    def _fit(self, node):
+        """Return (device, server, slope) of the line of node, None if it has no points."""
+        with self.lock:
+            points = list(self.points.get(node, ()))
+        if not points:
+            return None
+
+        # centered on the last point, so the large absolute times do not lose precision
+        x0, y0 = points[-1]
+        xs = [x - x0 for x, _ in points]
+        ys = [y - y0 for _, y in points]
+        n = len(points)
+        mean_x = sum(xs) / n
+        mean_y = sum(ys) / n
+        var = sum((x - mean_x) ** 2 for x in xs)
+        if xs[-1] - xs[0] < self.min_span or var == 0:
+            return x0 + mean_x, y0 + mean_y, 1.0
+        slope = sum((x - mean_x) * (y - mean_y) for x, y in zip(xs, ys)) / var
+        return x0 + mean_x, y0 + mean_y, slope
+
+    def to_server(self, node, timestamp):
+        """Convert a timestamp in microseconds of node to seconds of the server, None if unknown."""
+        if timestamp is None:
+            return None
+        fit = self._fit(node)
+        if fit is None:
+            return None
+        device, server, slope = fit
+        return server + (timestamp / 1e6 - device) * slope
+
+    def drift_ppm(self, node):
+        """Return the drift of the clock of node in parts per million, 0 if unknown.
+
+        Positive when the clock of the node runs fast. The slope of the fit is
+        server seconds per node second, so a fast node has a slope below 1.
+        """
+        fit = self._fit(node)
+        return 0.0 if fit is None else (1.0 / fit[2] - 1.0) * 1e6
@@ -0,0 +1,80 @@
+"""Simulation of the clock synchronization of timesync.py.
+
+Synthetic nodes with a known offset and drift send a batch every period
+seconds over a network with jitter, with the round trip time of the previous
+batch, as the driver does. The server holds each ack until the batch is
+durable, and the node takes the hold echoed in the ack off its round trip
+time. For each node it checks that ClockSync recovers
+the drift, with its sign, and maps the timestamps of the node to the clock of
+the server within the error bounds; it exits with 1 otherwise.
+
+Usage: python3 timesync_sim.py [--duration 3600] [--period 20] [--jitter 0.002] [--hold 1.0]
+"""
+import argparse
+import random
+import sys
+
+from timesync import ClockSync
+
+# drift of the nodes in ppm, positive when the clock of the node runs fast
+DRIFTS = (-100.0, -20.0, 0.0, 20.0, 100.0)
+# one-way latency of the network in seconds, the jitter is added on each way
+LATENCY = 0.010
+MAX_DRIFT_ERROR_PPM = 5.0
+MAX_TIME_ERROR = 0.002
+
+
+def node_time(server_time, offset, drift_ppm):
+    """Clock of the node in microseconds at server_time in seconds."""
+    return round((server_time - offset) * (1 + drift_ppm / 1e6) * 1e6)
+
+
+def simulate(sync, node, offset, drift_ppm, args, rng):
+    """Feed the batches of one node, return the max error of the mapping in seconds over the last window."""
+    last_rtt = 0
+    errors = []
+    t = offset + 100.0
+    while t < offset + args.duration:
+        send_time = node_time(t, offset, drift_ppm)
+        uplink = LATENCY + rng.uniform(0, args.jitter)
+        downlink = LATENCY + rng.uniform(0, args.jitter)
+        # the wait of the server for its write-ahead log, up to its ack timeout
+        hold = rng.uniform(0, args.hold)
+        sync.observe(node, send_time, t + uplink, last_rtt)
+        # the rtt is measured with the clock of the node, less the hold measured by the server,
+        # and sent with the next batch
+        last_rtt = max(0, round((uplink + hold + downlink) * (1 + drift_ppm / 1e6) * 1e6) - round(hold * 1e6))
+        # a sample taken between two batches
+        sample = t + rng.uniform(0, args.period)
+        if t > offset + args.duration / 2:
+            errors.append(abs(sync.to_server(node, node_time(sample, offset, drift_ppm)) - sample))
+        t += args.period
+    return max(errors)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--duration', type=float, default=3600.0, help='seconds of each node')
+    parser.add_argument('--period', type=float, default=20.0, help='seconds between batches')
+    parser.add_argument('--jitter', type=float, default=0.002, help='max jitter of each way in seconds')
+    parser.add_argument('--hold', type=float, default=1.0, help='max hold of the ack by the server in seconds')
+    args = parser.parse_args()
+
+    rng = random.Random(1)
+    sync = ClockSync()
+    ok = True
+    print('{:<8} {:>10} {:>12} {:>10} {:>12}'.format('node', 'drift_ppm', 'estimated', 'error_ppm', 'max_err_ms'))
+    for index, drift in enumerate(DRIFTS):
+        node = 'node{}'.format(index)
+        offset = rng.uniform(0, 1e6)
+        time_error = simulate(sync, node, offset, drift, args, rng)
+        estimated = sync.drift_ppm(node)
+        failed = abs(estimated - drift) > MAX_DRIFT_ERROR_PPM or time_error > MAX_TIME_ERROR
+        ok &= not failed
+        print('{:<8} {:>10.1f} {:>12.2f} {:>10.2f} {:>12.3f}{}'.format(
+            node, drift, estimated, estimated - drift, time_error * 1000, '  FAIL' if failed else ''))
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,216 @@
+import os
+import struct
+import threading
+import time
+import zlib
+from collections import namedtuple
+
+# Kind of the frames of a record
+RECORD_BATCH = 0
+RECORD_AGGREGATED = 1
+
+# A record of the log: receive time of the server, node that sent it, kind and the frames as received
+Record = namedtuple('Record', 'recv_time node kind frames')
+
+# length of the body, crc32 of the body
+record_header_format = "<I I"
+record_header_size = struct.calcsize(record_header_format)
+# receive time, kind, length of the node, followed by the node and the frames
+record_body_format = "<d B B"
+record_body_size = struct.calcsize(record_body_format)
+
+
+class WriteAheadLog:
+    """Append-only log of the frames received, made durable with group commit.
+
+    The frames are appended as they are decoded and written to the file by a
+    committer thread, with one fsync for every group of appends: the group is
+    committed commit_interval seconds after its first append, or as soon as it
+    reaches commit_bytes. A device batch is only acknowledged once the offset
+    returned by append() is durable (wait_durable()), so the device can free
+    the samples it kept for that batch.
+
+    Each record is checked by a crc32. A record torn by a crash is dropped,
+    with everything after it, when the log is opened again.
+
+    When a commit fails, as on a full disk, the waiters get the error and the
+    group is written again every commit_retry seconds, with the appends made
+    meanwhile, until it succeeds or the log is closed.
+    """
+
+    def __init__(self, path, commit_interval=0.005, commit_bytes=64 * 1024, commit_retry=1.0):
+        self.path = path
+        self.commit_interval = commit_interval
+        self.commit_bytes = commit_bytes
+        self.commit_retry = commit_retry
+
+        # drop the torn tail, so the new records follow the last valid one
+        valid_end = 0
+        for _, valid_end in _scan(path):
+            pass
+        self.fd = os.open(path, os.O_WRONLY | os.O_CREAT, 0o644)
+        os.ftruncate(self.fd, valid_end)
+        os.lseek(self.fd, valid_end, os.SEEK_SET)
+
+        self.lock = threading.Lock()
+        self.pending_ready = threading.Condition(self.lock)
+        self.durable_ready = threading.Condition(self.lock)
+        self.pending = []
+        self.pending_bytes = 0
+        self.first_pending = None
+        self.appended = valid_end
+        self.durable = valid_end
+        self.commits = 0
+        self.error = None
+        self.closed = False
+
+        self.committer = threading.Thread(target=self._commit_loop, daemon=True)
+        self.committer.start()
+
+    def append(self, node, kind, frames, recv_time=None):
+        """Queue one record to be committed.
+
+        Returns the offset of the end of the record in the log, to be passed to
+        wait_durable().
+        """
+        node = node.encode()
+        body = struct.pack(record_body_format, time.time() if recv_time is None else recv_time,
+                           kind, len(node)) + node + frames
+        record = struct.pack(record_header_format, len(body), zlib.crc32(body)) + body
+        with self.lock:
+            if self.closed:
+                raise ValueError('write-ahead log is closed')
+            if not self.pending:
+                self.first_pending = time.monotonic()
+            self.pending.append(record)
+            self.pending_bytes += len(record)
+            self.appended += len(record)
+            offset = self.appended
+            if len(self.pending) == 1 or self.pending_bytes >= self.commit_bytes:
+                self.pending_ready.notify()
+            return offset
+
+    def wait_durable(self, offset, timeout=None):
+        """Wait until the log is durable up to offset.
+
+        Returns False on timeout. Raises OSError while the log can not be written.
+        """
+        deadline = None if timeout is None else time.monotonic() + timeout
+        with self.lock:
+            while self.durable < offset:
+                if self.error is not None:
+                    raise self.error
+                remaining = None if deadline is None else deadline - time.monotonic()
+                if remaining is not None and remaining <= 0:
+                    return False
+                self.durable_ready.wait(remaining)
+            return True
+
+    def close(self):
+        """Commit the pending records and close the log."""
+        with self.lock:
+            self.closed = True
+            self.pending_ready.notify()
+        self.committer.join()
+        os.close(self.fd)
+
+    def _commit_loop(self):
+        # group of the last failed commit, written again with the next one
+        failed = b''
+        while True:
+            with self.lock:
+                while not self.pending and not failed and not self.closed:
+                    self.pending_ready.wait()
+                if not self.pending and not failed:
+                    return
+                if failed:
+                    # the disk may take a while to recover, the next attempt waits unless the log is closing
+                    deadline = time.monotonic() + self.commit_retry
+                    while not self.closed:
+                        remaining = deadline - time.monotonic()
+                        if remaining <= 0:
+                            break
+                        self.pending_ready.wait(remaining)
+                else:
+                    # the group grows until its interval expires or it is large enough
+                    deadline = self.first_pending + self.commit_interval
+                    while self.pending_bytes < self.commit_bytes and not self.closed:
+                        remaining = deadline - time.monotonic()
+                        if remaining <= 0:
+                            break
+                        self.pending_ready.wait(remaining)
+                group = failed + b''.join(self.pending)
+                end = self.appended
+                closing = self.closed
+                self.pending = []
+                self.pending_bytes = 0
+
+            try:
+                view = memoryview(group)
+                while view:
+                    view = view[os.write(self.fd, view):]
+                _sync(self.fd)
+            except OSError as error:
+                with self.lock:
+                    self.error = error
+                    self.durable_ready.notify_all()
+                if closing:
+                    return
+                failed = group
+                # the retry starts at the end of the durable records, over what the failed write left
+                try:
+                    os.ftruncate(self.fd, self.durable)
+                except OSError:
+                    pass
+                try:
+                    os.lseek(self.fd, self.durable, os.SEEK_SET)
+                except OSError:
+                    pass
+                continue
+
+            failed = b''
+            with self.lock:
+                self.durable = end
+                self.error = None
+                self.commits += 1
+                self.durable_ready.notify_all()
+
+
+def _sync(fd):
+    # the size of the file changes on every commit, so fdatasync also flushes it
+    if hasattr(os, 'fdatasync'):
+        os.fdatasync(fd)
+    else:
+        os.fsync(fd)
+
+
+def _scan(path):
+    """Yield (Record, end offset) for the valid records of the log at path."""
+    try:
+        log = open(path, 'rb')
+    except FileNotFoundError:
+        return
+    with log:
+        offset = 0
+        while True:
+            header = log.read(record_header_size)
+            if len(header) < record_header_size:
+                return
+            length, crc = struct.unpack(record_header_format, header)
+            body = log.read(length)
+            if len(body) < length or length < record_body_size or zlib.crc32(body) != crc:
+                return
+            recv_time, kind, node_len = struct.unpack_from(record_body_format, body)
+            node = body[record_body_size:record_body_size + node_len].decode()
+            offset += record_header_size + length
+            yield Record(recv_time, node, kind, body[record_body_size + node_len:]), offset
+
+
+def replay(path):
+    """Yield the valid records of the log at path, in order.
+
+    The frames of a record are decoded with decode_batch() or decode_aggregated()
+    of frames.py, according to its kind.
+    """
+    for record, _ in _scan(path):
+        yield record
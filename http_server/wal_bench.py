@@ -0,0 +1,119 @@
+"""Benchmark of the group commit of the write-ahead log.
+
+Concurrent clients append device batches and wait for them to be durable, as
+handle_client() does before the ack. For every commit setting it prints the
+throughput and the commit latency seen by a client, next to the baseline of
+one fsync per batch, so the latency vs throughput trade-off of the interval
+and of the size of the groups can be compared on the disk of the server.
+The batches go from a few samples up to a full frame of the driver, so with
+enough clients the groups reach their size before their interval.
+
+Usage: python3 wal_bench.py [--duration 1.0] [--dir .] [--clients 1,16,64,256] [--samples 5,73]
+"""
+import argparse
+import os
+import tempfile
+import threading
+import time
+
+from wal import WriteAheadLog, RECORD_BATCH, _sync
+
+# A batch with timestamps: 28 bytes of header and 20 bytes per sample,
+# MAX_LENGHT samples by default and 73 in a full frame of TRANSMISSION_BUFFER_SIZE
+BATCH_HEADER_SIZE = 28
+SAMPLE_SIZE = 20
+
+
+class SyncPerBatch:
+    """Baseline without group commit: every batch is written and synced on its own."""
+
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644)
+        self.lock = threading.Lock()
+        self.commits = 0
+
+    def append(self, node, kind, frames, recv_time=None):
+        with self.lock:
+            os.write(self.fd, frames)
+            _sync(self.fd)
+            self.commits += 1
+            return 0
+
+    def wait_durable(self, offset, timeout=None):
+        return True
+
+    def close(self):
+        os.close(self.fd)
+
+
+def run(log, clients, duration, batch):
+    """Return (batches/s, fsyncs/s, p50 latency, p99 latency) of clients appending batch to log."""
+    latencies = [[] for _ in range(clients)]
+    stop = threading.Event()
+
+    def client(index):
+        node = '10.0.0.{}'.format(index)
+        while not stop.is_set():
+            start = time.perf_counter()
+            log.wait_durable(log.append(node, RECORD_BATCH, batch))
+            latencies[index].append(time.perf_counter() - start)
+
+    threads = [threading.Thread(target=client, args=(i,)) for i in range(clients)]
+    commits = log.commits
+    start = time.perf_counter()
+    for thread in threads:
+        thread.start()
+    time.sleep(duration)
+    stop.set()
+    for thread in threads:
+        thread.join()
+    elapsed = time.perf_counter() - start
+    commits = log.commits - commits
+
+    samples = sorted(latency for client_latencies in latencies for latency in client_latencies)
+    if not samples:
+        return 0.0, 0.0, 0.0, 0.0
+    return (len(samples) / elapsed, commits / elapsed,
+            samples[len(samples) // 2], samples[min(len(samples) - 1, int(len(samples) * 0.99))])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--duration', type=float, default=1.0, help='seconds per point')
+    parser.add_argument('--dir', default=None, help='directory of the log, on the disk to be measured')
+    parser.add_argument('--clients', default='1,16,64,256', help='comma separated numbers of concurrent clients')
+    parser.add_argument('--samples', default='5,73', help='comma separated numbers of samples per batch')
+    args = parser.parse_args()
+    clients = [int(n) for n in args.clients.split(',')]
+    samples = [int(n) for n in args.samples.split(',')]
+
+    # commit interval in ms, commit size in KB; None is the baseline of one fsync per batch
+    settings = [None, (0, 64), (1, 64), (2, 64), (5, 64), (10, 64), (20, 64), (20, 4), (20, 16)]
+
+    print('{:.1f} s per point\n'.format(args.duration))
+    print('{:<16} {:>7} {:>8} {:>11} {:>11} {:>9} {:>9} {:>9}'.format(
+        'commit', 'batch_B', 'clients', 'batches/s', 'samples/s', 'fsyncs/s', 'p50_ms', 'p99_ms'))
+
+    with tempfile.TemporaryDirectory(dir=args.dir) as directory:
+        path = os.path.join(directory, 'bench.wal')
+        for samples_per_batch in samples:
+            batch = bytes(BATCH_HEADER_SIZE + SAMPLE_SIZE * samples_per_batch)
+            for setting in settings:
+                for n in clients:
+                    if setting is None:
+                        name = 'fsync/batch'
+                        log = SyncPerBatch(path)
+                    else:
+                        interval, size = setting
+                        name = '{}ms/{}KB'.format(interval, size)
+                        if os.path.exists(path):
+                            os.unlink(path)
+                        log = WriteAheadLog(path, interval / 1000.0, size * 1024)
+                    batches, fsyncs, p50, p99 = run(log, n, args.duration, batch)
+                    log.close()
+                    print('{:<16} {:>7} {:>8} {:>11.0f} {:>11.0f} {:>9.0f} {:>9.2f} {:>9.2f}'.format(
+                        name, len(batch), n, batches, batches * samples_per_batch, fsyncs, p50 * 1000, p99 * 1000))
+
+
+if __name__ == '__main__':
+    main()